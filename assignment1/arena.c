@@ -0,0 +1,165 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * Arena (bump) allocator. Everything allocated for a single line of
+ * input comes from here and is thrown away in one go with arena_reset()
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define CHUNK_SIZE  4096
+#define ALIGN(n)    (((n) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+static chunk_t *
+chunk_new(arena_t *arena, size_t size)
+{
+  if (size < CHUNK_SIZE) {
+    size = CHUNK_SIZE;
+  }
+  chunk_t *chunk = malloc(sizeof(chunk_t) + size);
+  if (!chunk) {
+    abort();
+  }
+  chunk->size = size;
+  chunk->used = 0;
+  chunk->next = arena->chunks;
+  arena->chunks = chunk;
+  arena->mallocs++;
+  return chunk;
+}
+
+void *
+arena_alloc(arena_t *arena, size_t size)
+{
+  chunk_t *chunk = arena->chunks;
+
+  size = ALIGN(size);
+  if (!chunk || chunk->size - chunk->used < size) {
+    // Grow geometrically so that a long line only needs a few chunks
+    chunk = chunk_new(arena, chunk && chunk->size * 2 > size ? chunk->size * 2 : size);
+  }
+  arena->last = &chunk->data[chunk->used];
+  chunk->used += size;
+  arena->total += size;
+  return arena->last;
+}
+
+void *
+arena_calloc(arena_t *arena, size_t nmemb, size_t size)
+{
+  void *ptr = arena_alloc(arena, nmemb * size);
+  memset(ptr, 0, nmemb * size);
+  return ptr;
+}
+
+/*
+ * The most recent allocation can usually be extended where it is,
+ * otherwise it is copied
+ */
+void *
+arena_realloc(arena_t *arena, void *ptr, size_t oldsize, size_t size)
+{
+  chunk_t *chunk = arena->chunks;
+
+  if (ptr && ptr == arena->last) {
+    size_t offset = (char *)ptr - chunk->data;
+    if (offset + ALIGN(size) <= chunk->size) {
+      arena->total += ALIGN(size) - (chunk->used - offset);
+      chunk->used = offset + ALIGN(size);
+      return ptr;
+    }
+  }
+  void *p = arena_alloc(arena, size);
+  if (ptr) {
+    memcpy(p, ptr, oldsize < size ? oldsize : size);
+  }
+  return p;
+}
+
+char *
+arena_strndup(arena_t *arena, const char *s, size_t n)
+{
+  char *p = arena_alloc(arena, n + 1);
+  memcpy(p, s, n);
+  p[n] = '\0';
+  return p;
+}
+
+arena_mark_t
+arena_mark(arena_t *arena)
+{
+  arena_mark_t mark = { arena->chunks, arena->chunks ? arena->chunks->used : 0,
+                        arena->total };
+  return mark;
+}
+
+/*
+ * Throw away everything allocated since the mark was taken, along with
+ * any chunks that were needed for it, and keep what came before
+ */
+void
+arena_release(arena_t *arena, arena_mark_t mark)
+{
+  while (arena->chunks != mark.chunk) {
+    chunk_t *next = arena->chunks->next;
+    free(arena->chunks);
+    arena->chunks = next;
+  }
+  if (arena->chunks) {
+    arena->chunks->used = mark.used;
+  }
+  arena->last = NULL;
+  arena->total = mark.total;
+}
+
+/*
+ * Throw away everything allocated. If the last line needed more than
+ * one chunk, replace them all with one big enough for it so the next
+ * such line makes no heap allocations at all
+ */
+void
+arena_reset(arena_t *arena)
+{
+  chunk_t *chunk = arena->chunks;
+
+  if (chunk && chunk->next) {
+    size_t size = arena->total;
+    arena_free(arena);
+    chunk = chunk_new(arena, size);
+  }
+  if (chunk) {
+    chunk->used = 0;
+  }
+  arena->last = NULL;
+  arena->total = 0;
+}
+
+void
+arena_free(arena_t *arena)
+{
+  while (arena->chunks) {
+    chunk_t *next = arena->chunks->next;
+    free(arena->chunks);
+    arena->chunks = next;
+  }
+  arena->last = NULL;
+  arena->total = 0;
+}
@@ -0,0 +1,77 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * Arena (bump) allocator interface
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+typedef struct chunk {
+  struct chunk *next;
+  size_t size;
+  size_t used;
+  char data[];
+} chunk_t;
+
+/*
+ * A zero filled arena_t is ready to use
+ */
+typedef struct {
+  chunk_t *chunks;          // Current chunk first
+  void *last;               // Most recent allocation, which can grow in place
+  size_t total;             // Bytes handed out since the last reset
+  unsigned long mallocs;    // Chunks we have had to allocate
+} arena_t;
+
+/*
+ * How far the arena had got, for arena_release() to go back to
+ */
+typedef struct {
+  chunk_t *chunk;
+  size_t used;
+  size_t total;
+} arena_mark_t;
+
+void *
+arena_alloc(arena_t *arena, size_t size);
+
+void *
+arena_calloc(arena_t *arena, size_t nmemb, size_t size);
+
+void *
+arena_realloc(arena_t *arena, void *ptr, size_t oldsize, size_t size);
+
+char *
+arena_strndup(arena_t *arena, const char *s, size_t n);
+
+arena_mark_t
+arena_mark(arena_t *arena);
+
+void
+arena_release(arena_t *arena, arena_mark_t mark);
+
+void
+arena_reset(arena_t *arena);
+
+void
+arena_free(arena_t *arena);
+
+#endif /* ARENA_H */
@@ -0,0 +1,629 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * Evaluate the 64 bit integer expressions of $(( ... )) and 'let' in
+ * the shell itself rather than forking expr for every step. Variables
+ * are read from and assigned back to the symbol table
+ *
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+
+#include "symtab.h"
+#include "arith.h"
+#include "lsh.h"
+
+/*
+ * The C operators, with their usual precedence, plus ** for powers.
+ * Arithmetic wraps rather than overflowing. Names are variables whose
+ * values are themselves expressions, and unset or empty is 0
+ */
+typedef struct {
+  const char *expr;         // The whole expression, for messages
+  const char *p;
+  const char *end;
+  int noeval;               // Inside the unused branch of && || ?:
+  int depth;                // Of variables holding expressions
+  const char *error;
+  const char *at;           // Where operator() last looked
+  size_t len;               // and what it found
+} arith_t;
+
+#define MAX_DEPTH   32
+
+static int64_t comma(arith_t *a);
+static int64_t assign(arith_t *a);
+
+static void
+error(arith_t *a, const char *message)
+{
+  if (!a->error) {
+    a->error = message;
+  }
+  // Give up on the rest of it
+  a->p = a->end;
+}
+
+static void
+blanks(arith_t *a)
+{
+  while (a->p < a->end && isspace((unsigned char)*a->p)) {
+    a->p++;
+  }
+}
+
+/*
+ * The length of the operator at p, always the longest one there is,
+ * so that < is never mistaken for the start of << or <=. Every level
+ * of precedence asks about the same position, so remember the answer
+ */
+static size_t
+operator(arith_t *a)
+{
+  const char *p = a->p;
+  size_t left = a->end - p, n = left > 0;
+
+  if (p == a->at) {
+    return a->len;
+  }
+  if (left >= 3 && (p[0] == '<' || p[0] == '>') && p[1] == p[0] && p[2] == '=') {
+    n = 3;                  // <<= >>=
+  } else if (left >= 2 && p[1] == '=' && p[0] && strchr("<>=!*/%+-&^|", p[0])) {
+    n = 2;                  // <= == != *= ...
+  } else if (left >= 2 && p[1] == p[0] && p[0] && strchr("*<>&|+-", p[0])) {
+    n = 2;                  // ** << && ++ ...
+  }
+  a->at = p;
+  a->len = n;
+  return n;
+}
+
+/*
+ * Take the operator op if it is next. A ++ or -- that gets this far
+ * is a binary + or - then a unary one, as in 1--1
+ */
+static int
+next(arith_t *a, const char *op)
+{
+  size_t n = strlen(op), len;
+
+  blanks(a);
+  len = operator(a);
+  if (n == 1 && len == 2 && (op[0] == '+' || op[0] == '-') &&
+      a->p[0] == op[0] && a->p[1] == op[0]) {
+    len = 1;
+  }
+  if (len != n || memcmp(a->p, op, n) != 0) {
+    return 0;
+  }
+  a->p += n;
+  return 1;
+}
+
+static int
+name_char(int c, int first)
+{
+  return isalpha(c) || c == '_' || (!first && isdigit(c));
+}
+
+/*
+ * A variable name, with or without a '$' (or '${ }') in front
+ */
+static size_t
+name(arith_t *a, char *buf, size_t size)
+{
+  const char *p = a->p;
+  int braced = 0;
+  size_t n = 0;
+
+  blanks(a);
+  p = a->p;
+  if (p < a->end && *p == '$') {
+    p++;
+    if (p < a->end && *p == '{') {
+      p++;
+      braced = 1;
+    }
+  }
+  if (p >= a->end || !name_char((unsigned char)*p, 1)) {
+    return 0;
+  }
+  while (p < a->end && name_char((unsigned char)*p, 0)) {
+    if (n + 1 < size) {
+      buf[n++] = *p;
+    }
+    p++;
+  }
+  buf[n] = '\0';
+  if (braced) {
+    if (p >= a->end || *p != '}') {
+      error(a, "bad substitution");
+      return 0;
+    }
+    p++;
+  }
+  a->p = p;
+  return n;
+}
+
+static int64_t
+number(arith_t *a)
+{
+  const char *p = a->p;
+  uint64_t v = 0;
+  int base = 10;
+
+  if (*p == '0' && p + 1 < a->end && (p[1] == 'x' || p[1] == 'X')) {
+    base = 16;
+    p += 2;
+  } else if (*p == '0') {
+    base = 8;
+  } else {
+    // base#digits
+    const char *q = p;
+    int b = 0;
+    while (q < a->end && isdigit((unsigned char)*q)) {
+      b = b * 10 + *q++ - '0';
+      if (b > 64) {
+        break;
+      }
+    }
+    if (q < a->end && *q == '#') {
+      if (b < 2 || b > 64) {
+        error(a, "invalid arithmetic base");
+        return 0;
+      }
+      base = b;
+      p = q + 1;
+    }
+  }
+  for (; p < a->end; p++) {
+    int c = (unsigned char)*p, d;
+    if (isdigit(c)) {
+      d = c - '0';
+    } else if (islower(c)) {
+      d = c - 'a' + 10;
+    } else if (isupper(c)) {
+      d = c - 'A' + (base <= 36 ? 10 : 36);
+    } else if (c == '@') {
+      d = 62;
+    } else if (c == '_') {
+      d = 63;
+    } else {
+      break;
+    }
+    if (d >= base) {
+      error(a, "value too great for base");
+      return 0;
+    }
+    v = v * base + d;
+  }
+  a->p = p;
+  return (int64_t)v;
+}
+
+/*
+ * The value of a variable, which may itself be an expression
+ */
+static int64_t
+variable(arith_t *a, char *var)
+{
+  symbol_t *symbol = symtab_lookup(symtab, var);
+  const char *value, *p;
+  uint64_t n = 0;
+  int64_t v;
+
+  if (symbol && symbol->type == SYM_INT) {
+    // Anything we have set ourselves is already a number
+    return symbol->number;
+  }
+  if (!symbol || !(value = symtab_string(symbol))) {
+    return 0;
+  }
+  arith_t inner = { value, value, NULL, 0, a->depth + 1 };
+  p = value + (*value == '-');
+
+  // Almost always just a decimal number
+  if (*p >= '1' && *p <= '9') {
+    while (*p >= '0' && *p <= '9' && n < UINT64_MAX / 10 - 1) {
+      n = n * 10 + *p++ - '0';
+    }
+    if (*p == '\0') {
+      return *value == '-' ? (int64_t)(0 - n) : (int64_t)n;
+    }
+  }
+  if (!*value) {
+    return 0;
+  }
+  if (inner.depth > MAX_DEPTH) {
+    error(a, "expression recursion level exceeded");
+    return 0;
+  }
+  inner.end = value + strlen(value);
+  v = comma(&inner);
+  blanks(&inner);
+  if (inner.error || inner.p != inner.end) {
+    error(a, inner.error ? inner.error : "syntax error in expression");
+    return 0;
+  }
+  return v;
+}
+
+/*
+ * Results are kept as numbers and only formatted if they are expanded
+ */
+static void
+set(arith_t *a, char *var, int64_t v)
+{
+  if (!a->noeval) {
+    symtab = symtab_set_int(symtab, var, v);
+  }
+}
+
+static int64_t
+primary(arith_t *a)
+{
+  char var[256];
+  int64_t v;
+
+  blanks(a);
+  if (a->p >= a->end) {
+    error(a, "syntax error: operand expected");
+    return 0;
+  }
+  if (next(a, "(")) {
+    v = comma(a);
+    if (!next(a, ")")) {
+      error(a, "missing ')'");
+    }
+    return v;
+  }
+  if (isdigit((unsigned char)*a->p)) {
+    v = number(a);
+    if (a->p < a->end && name_char((unsigned char)*a->p, 0)) {
+      error(a, "value too great for base");
+    }
+    return v;
+  }
+  if (name(a, var, sizeof(var))) {
+    v = variable(a, var);
+    // Postfix ++ and --
+    if (next(a, "++")) {
+      set(a, var, (int64_t)((uint64_t)v + 1));
+    } else if (next(a, "--")) {
+      set(a, var, (int64_t)((uint64_t)v - 1));
+    }
+    return v;
+  }
+  error(a, "syntax error: operand expected");
+  return 0;
+}
+
+static int64_t
+unary(arith_t *a)
+{
+  char var[256];
+
+  blanks(a);
+  if (a->p + 1 < a->end && (a->p[0] == '+' || a->p[0] == '-') &&
+      a->p[1] == a->p[0]) {
+    // Prefix ++ and -- of a variable, otherwise two signs
+    const char *start = a->p;
+    int delta = a->p[0] == '+' ? 1 : -1;
+    a->p += 2;
+    if (name(a, var, sizeof(var))) {
+      int64_t v = (int64_t)((uint64_t)variable(a, var) + delta);
+      set(a, var, v);
+      return v;
+    }
+    a->p = start;
+  }
+  if (next(a, "-")) {
+    return (int64_t)(0 - (uint64_t)unary(a));
+  } else if (next(a, "+")) {
+    return unary(a);
+  } else if (next(a, "!")) {
+    return !unary(a);
+  } else if (next(a, "~")) {
+    return ~unary(a);
+  }
+  return primary(a);
+}
+
+static int64_t
+power(int64_t base, int64_t e)
+{
+  uint64_t v = 1, b = base;
+
+  while (e) {
+    if (e & 1) {
+      v *= b;
+    }
+    b *= b;
+    e >>= 1;
+  }
+  return (int64_t)v;
+}
+
+static int64_t
+divide(arith_t *a, int64_t l, int64_t r, int remainder)
+{
+  if (r == 0) {
+    if (!a->noeval) {
+      error(a, "division by 0");
+    }
+    return 0;
+  }
+  if (r == -1) {
+    // INT64_MIN / -1 would trap
+    return remainder ? 0 : (int64_t)(0 - (uint64_t)l);
+  }
+  return remainder ? l % r : l / r;
+}
+
+/*
+ * The binary operators, loosest first. Each is identified by its first
+ * character and its length, which is all operator() tells us
+ */
+enum {
+  OR = 1, AND, BOR, XOR, BAND, EQ, NE, LT, LE, GT, GE, SHL, SHR,
+  ADD, SUB, MUL, DIV, MOD, POW
+};
+
+static const unsigned char precedence[] = {
+  [OR] = 1, [AND] = 2, [BOR] = 3, [XOR] = 4, [BAND] = 5,
+  [EQ] = 6, [NE] = 6,
+  [LT] = 7, [LE] = 7, [GT] = 7, [GE] = 7,
+  [SHL] = 8, [SHR] = 8,
+  [ADD] = 9, [SUB] = 9,
+  [MUL] = 10, [DIV] = 10, [MOD] = 10,
+  [POW] = 11,
+};
+
+/*
+ * The binary operator next in the expression, or 0 if there isn't one
+ */
+static int
+binary_operator(arith_t *a, size_t *len)
+{
+  const char *p;
+  size_t n;
+
+  blanks(a);
+  p = a->p;
+  n = operator(a);
+  if (n == 1) {
+    *len = 1;
+    switch (*p) {
+    case '|': return BOR;
+    case '^': return XOR;
+    case '&': return BAND;
+    case '<': return LT;
+    case '>': return GT;
+    case '+': return ADD;
+    case '-': return SUB;
+    case '*': return MUL;
+    case '/': return DIV;
+    case '%': return MOD;
+    }
+  } else if (n == 2) {
+    *len = 2;
+    switch (p[0] * 256 + p[1]) {
+    case '|' * 256 + '|': return OR;
+    case '&' * 256 + '&': return AND;
+    case '=' * 256 + '=': return EQ;
+    case '!' * 256 + '=': return NE;
+    case '<' * 256 + '=': return LE;
+    case '>' * 256 + '=': return GE;
+    case '<' * 256 + '<': return SHL;
+    case '>' * 256 + '>': return SHR;
+    case '*' * 256 + '*': return POW;
+    // A binary + or - then a unary one, as in 1--1
+    case '+' * 256 + '+': *len = 1; return ADD;
+    case '-' * 256 + '-': *len = 1; return SUB;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Operators binding at least as tightly as min, by precedence climbing
+ * rather than a function per level so that each operand costs one look
+ * at the operator after it. The side of && or || not needed for the
+ * answer is parsed but has no effects
+ */
+static int64_t
+binary(arith_t *a, int min)
+{
+  int64_t l = unary(a), r;
+  size_t len;
+  int op;
+
+  while ((op = binary_operator(a, &len)) && precedence[op] >= min) {
+    int noeval = a->noeval;
+    a->p += len;
+    if (op == AND || op == OR) {
+      a->noeval |= op == AND ? !l : !!l;
+    }
+    // ** is right associative, everything else left
+    r = binary(a, precedence[op] + (op != POW));
+    a->noeval = noeval;
+
+    switch (op) {
+    case OR:   l = l || r;                                         break;
+    case AND:  l = l && r;                                         break;
+    case BOR:  l |= r;                                             break;
+    case XOR:  l ^= r;                                             break;
+    case BAND: l &= r;                                             break;
+    case EQ:   l = l == r;                                         break;
+    case NE:   l = l != r;                                         break;
+    case LT:   l = l < r;                                          break;
+    case LE:   l = l <= r;                                         break;
+    case GT:   l = l > r;                                          break;
+    case GE:   l = l >= r;                                         break;
+    case SHL:  l = (int64_t)((uint64_t)l << (r & 63));             break;
+    case SHR:  l >>= r & 63;                                       break;
+    case ADD:  l = (int64_t)((uint64_t)l + (uint64_t)r);           break;
+    case SUB:  l = (int64_t)((uint64_t)l - (uint64_t)r);           break;
+    case MUL:  l = (int64_t)((uint64_t)l * (uint64_t)r);           break;
+    case DIV:  l = divide(a, l, r, 0);                             break;
+    case MOD:  l = divide(a, l, r, 1);                             break;
+    case POW:
+      if (r < 0) {
+        error(a, "exponent less than 0");
+        return 0;
+      }
+      l = power(l, r);
+      break;
+    }
+  }
+  return l;
+}
+
+static int64_t
+conditional(arith_t *a)
+{
+  int64_t v = binary(a, 1), t, f;
+  int noeval = a->noeval;
+
+  if (!next(a, "?")) {
+    return v;
+  }
+  a->noeval = noeval || !v;
+  t = assign(a);
+  a->noeval = noeval;
+  if (!next(a, ":")) {
+    error(a, "':' expected for conditional expression");
+    return 0;
+  }
+  a->noeval = noeval || v;
+  f = conditional(a);
+  a->noeval = noeval;
+  return v ? t : f;
+}
+
+/*
+ * name = expr, or name op= expr for any binary operator op
+ */
+static int64_t
+assign(arith_t *a)
+{
+  static const char *ops[] = {
+    "=", "*=", "/=", "%=", "+=", "-=", "<<=", ">>=", "&=", "^=", "|=", NULL
+  };
+  const char *start;
+  char var[256];
+  int i;
+
+  blanks(a);
+  start = a->p;
+  if (name(a, var, sizeof(var))) {
+    size_t len;
+    blanks(a);
+    len = operator(a);
+    for (i = 0; ops[i]; i++) {
+      size_t n = strlen(ops[i]);
+      if (len == n && memcmp(a->p, ops[i], n) == 0) {
+        int64_t l = 0, r;
+        a->p += n;
+        if (n > 1) {
+          l = variable(a, var);
+        }
+        r = assign(a);
+        switch (ops[i][0]) {
+        case '=': l = r;                                        break;
+        case '*': l = (int64_t)((uint64_t)l * (uint64_t)r);     break;
+        case '/': l = divide(a, l, r, 0);                       break;
+        case '%': l = divide(a, l, r, 1);                       break;
+        case '+': l = (int64_t)((uint64_t)l + (uint64_t)r);     break;
+        case '-': l = (int64_t)((uint64_t)l - (uint64_t)r);     break;
+        case '<': l = (int64_t)((uint64_t)l << (r & 63));       break;
+        case '>': l >>= r & 63;                                 break;
+        case '&': l &= r;                                       break;
+        case '^': l ^= r;                                       break;
+        case '|': l |= r;                                       break;
+        }
+        set(a, var, l);
+        return l;
+      }
+    }
+    // Just a name in an expression, so start again
+    a->p = start;
+  }
+  return conditional(a);
+}
+
+static int64_t
+comma(arith_t *a)
+{
+  int64_t v = assign(a);
+  while (next(a, ",")) {
+    v = assign(a);
+  }
+  return v;
+}
+
+/*
+ * Evaluate the first len bytes of expr into *result. Returns 0 or, if
+ * the expression is not valid, -1 having said why
+ */
+int
+arith_eval(const char *expr, size_t len, int64_t *result)
+{
+  arith_t a = { expr, expr, expr + len };
+
+  blanks(&a);
+  *result = a.p < a.end ? comma(&a) : 0;
+  blanks(&a);
+  if (!a.error && a.p != a.end) {
+    a.error = "syntax error in expression";
+  }
+  if (a.error) {
+    fprintf(stderr, "%.*s: %s\n", (int)len, expr, a.error);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * let expr ...
+ *
+ * Evaluate each argument. The exit code is 0 if the last came to
+ * something other than 0, 1 if it came to 0 and 2 if any was invalid
+ */
+int
+lsh_let(int argc, char **argv)
+{
+  int64_t v = 0;
+  int i;
+
+  if (argc < 2) {
+    fprintf(stderr, "%s: expression expected\n", argv[0]);
+    return 2;
+  }
+  for (i = 1; i < argc; i++) {
+    if (arith_eval(argv[i], strlen(argv[i]), &v) < 0) {
+      return 2;
+    }
+  }
+  return v == 0;
+}
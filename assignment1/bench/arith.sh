@@ -0,0 +1,34 @@
+#!/bin/sh
+# vim: set ts=2 sw=2 expandtab:
+#
+# A counter loop, unrolled, stepped with let and $(( )) in the shell
+# and then with expr, which is what scripts had to fork before
+#
+# usage: bench/arith.sh [lsh binary] [lines]
+
+LSH=${1:-./lsh}
+LINES=${2:-2000}
+DIR=$(mktemp -d)
+trap 'rm -rf $DIR' EXIT
+
+now() {
+  date +%s%N
+}
+
+awk -v n=$LINES 'BEGIN {
+  print "i=0"
+  for (k = 0; k < n; k++) print (k % 2 ? "let i++ \"j = i * 3 + 7 / 2\"" : "i=$((i + 1))")
+  print "echo $i"
+}' > $DIR/let.lsh
+awk -v n=$LINES 'BEGIN {
+  print "i=0"
+  for (k = 0; k < n; k++) print "expr $i + 1 \\* 3 + 7 / 2"
+}' > $DIR/expr.lsh
+
+for kind in let expr; do
+  start=$(now)
+  $LSH $DIR/$kind.lsh > /dev/null
+  ms=$(( ($(now) - start) / 1000000 ))
+  printf "%-5s %6d steps %6d ms %8d steps/sec\n" $kind $LINES $ms \
+         $(( LINES * 1000 / (ms > 0 ? ms : 1) ))
+done
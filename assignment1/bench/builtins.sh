@@ -0,0 +1,42 @@
+#!/bin/sh
+# vim: set ts=2 sw=2 expandtab:
+#
+# Scripts dominated by echo, printf, test and friends, run once with
+# the builtins and once with the same commands by path, which always
+# runs the external program
+#
+# usage: bench/builtins.sh [lsh binary] [lines]
+
+LSH=${1:-./lsh}
+LINES=${2:-2000}
+DIR=$(mktemp -d)
+trap 'rm -rf $DIR' EXIT
+
+now() {
+  date +%s%N
+}
+
+# generate <file> <prefix for each command>
+generate() {
+  awk -v n=$LINES -v p="$2" 'BEGIN {
+    for (i = 0; i < n; i++) {
+      if (i % 6 == 0) printf "%secho line %d\n", p, i
+      else if (i % 6 == 1) printf "%sprintf \"%%s=%%d\\n\" x %d\n", p, i
+      else if (i % 6 == 2) printf "%stest -d /tmp\n", p
+      else if (i % 6 == 3) printf "%s[ %d -lt 100 ]\n", p, i
+      else if (i % 6 == 4) printf "%sbasename /usr/lib/file%d.so .so\n", p, i
+      else printf "%strue\n", p
+    }
+  }' > $1
+}
+
+generate $DIR/builtin.lsh ""
+generate $DIR/external.lsh "/usr/bin/"
+
+for kind in builtin external; do
+  start=$(now)
+  $LSH $DIR/$kind.lsh > /dev/null
+  ms=$(( ($(now) - start) / 1000000 ))
+  printf "%-9s %6d lines %6d ms %8d lines/sec\n" $kind $LINES $ms \
+         $(( LINES * 1000 / (ms > 0 ? ms : 1) ))
+done
@@ -0,0 +1,40 @@
+#!/bin/sh
+# vim: set ts=2 sw=2 expandtab:
+#
+# Running the same script again and again, parsed each time against
+# run from its cache. Every line is a setting and a builtin, so what
+# is left once the cache is used is mostly running them
+#
+# usage: bench/cache.sh [lsh binary] [lines]
+
+LSH=${1:-./lsh}
+LINES=${2:-5000}
+DIR=$(mktemp -d)
+trap 'rm -rf $DIR' EXIT
+
+now() {
+  date +%s%N
+}
+
+# Best of 5 wall clock times, in ms, with LSH_CACHE=$1
+best() {
+  best=
+  for i in 1 2 3 4 5; do
+    start=$(now)
+    LSH_CACHE=$1 $LSH $DIR/script.lsh > /dev/null
+    ms=$(( ($(now) - start) / 1000000 ))
+    if [ -z "$best" ] || [ $ms -lt $best ]; then
+      best=$ms
+    fi
+  done
+  echo $best
+}
+
+awk -v n=$LINES 'BEGIN { for (i = 0; i < n; i++) printf "V%d=%d NAME=\"quoted value %d\" cd . --opt=x \"$V1\" ${A[@]}\n", i % 100, i, i }' > $DIR/script.lsh
+
+printf "  %-10s %6d ms\n" parsed $(best off)
+start=$(now)
+$LSH $DIR/script.lsh > /dev/null
+printf "  %-10s %6d ms\n" first $(( ($(now) - start) / 1000000 ))
+printf "  %-10s %6d ms\n" cached $(best on)
+printf "  %-10s %6d bytes, %d in the cache\n" script $(wc -c < $DIR/script.lsh) $(wc -c < $DIR/.script.lsh.lshc)
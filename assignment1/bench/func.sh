@@ -0,0 +1,54 @@
+#!/bin/sh
+# vim: set ts=2 sw=2 expandtab:
+#
+# Calling a function against running the lines of its body written out
+# in full each time, which are tokenised and parsed every time
+#
+# usage: bench/func.sh [lsh binary] [calls]
+
+LSH=${1:-./lsh}
+CALLS=${2:-20000}
+DIR=$(mktemp -d)
+trap 'rm -rf $DIR' EXIT
+
+now() {
+  date +%s%N
+}
+
+# Best of 3 wall clock times, in ms, of running $1
+best() {
+  best=
+  for i in 1 2 3; do
+    start=$(now)
+    LSH_CACHE=off $LSH $1 > /dev/null
+    ms=$(( ($(now) - start) / 1000000 ))
+    if [ -z "$best" ] || [ $ms -lt $best ]; then
+      best=$ms
+    fi
+  done
+  echo $best
+}
+
+BODY='V="value of $1" W=$2 cd . --opt=x "$V" ${A[@]}
+let N=N+$2
+X=$1 Y=$2 Z="$1 and $2" cd .'
+
+{
+  echo 'work() {'
+  echo "$BODY"
+  echo '}'
+  awk -v n=$CALLS 'BEGIN { for (i = 0; i < n; i++) printf "work arg%d %d\n", i, i }'
+} > $DIR/called.lsh
+awk -v n=$CALLS -v body="$BODY" 'BEGIN {
+  for (i = 0; i < n; i++) {
+    b = body
+    gsub(/\$1/, "arg" i, b)
+    gsub(/\$2/, i, b)
+    print b
+  }
+}' > $DIR/inline.lsh
+
+inline=$(best $DIR/inline.lsh)
+called=$(best $DIR/called.lsh)
+printf "  %-8s %6d ms  %4d ns/line\n" inline $inline $(( inline * 1000000 / (CALLS * 3) ))
+printf "  %-8s %6d ms  %4d ns/line\n" called $called $(( called * 1000000 / (CALLS * 3) ))
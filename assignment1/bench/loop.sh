@@ -0,0 +1,59 @@
+#!/bin/sh
+# vim: set ts=2 sw=2 expandtab:
+#
+# A loop against the same lines unrolled, as generated scripts have had
+# to be, which are tokenised and parsed every time and make the script
+# that much bigger
+#
+# usage: bench/loop.sh [lsh binary] [iterations]
+
+LSH=${1:-./lsh}
+ITERATIONS=${2:-20000}
+DIR=$(mktemp -d)
+trap 'rm -rf $DIR' EXIT
+
+now() {
+  date +%s%N
+}
+
+# Best of 3 wall clock times, in ms, of running $1
+best() {
+  best=
+  for i in 1 2 3; do
+    start=$(now)
+    LSH_CACHE=off $LSH $1 > /dev/null
+    ms=$(( ($(now) - start) / 1000000 ))
+    if [ -z "$best" ] || [ $ms -lt $best ]; then
+      best=$ms
+    fi
+  done
+  echo $best
+}
+
+{
+  echo 'n=0'
+  echo 'while let "n < '$ITERATIONS'"; do'
+  echo '  let "n += 1"'
+  echo '  if let "n % 2"; then'
+  echo '    V="odd $n" cd .'
+  echo '  else'
+  echo '    V="even $n" cd .'
+  echo '  fi'
+  echo 'done'
+} > $DIR/loop.lsh
+awk -v n=$ITERATIONS 'BEGIN {
+  print "n=0"
+  for (i = 1; i <= n; i++) {
+    print "let \"n < " n "\""
+    print "let \"n += 1\""
+    print "let \"n % 2\""
+    printf "V=\"%s $n\" cd .\n", i % 2 ? "odd" : "even"
+  }
+}' > $DIR/unrolled.lsh
+
+unrolled=$(best $DIR/unrolled.lsh)
+loop=$(best $DIR/loop.lsh)
+printf "  %-8s %6d ms  %4d ns/line %8d bytes\n" unrolled $unrolled \
+       $(( unrolled * 1000000 / (ITERATIONS * 4) )) $(wc -c < $DIR/unrolled.lsh)
+printf "  %-8s %6d ms  %4d ns/line %8d bytes\n" loop $loop \
+       $(( loop * 1000000 / (ITERATIONS * 4) )) $(wc -c < $DIR/loop.lsh)
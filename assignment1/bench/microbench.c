@@ -0,0 +1,456 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * Micro benchmarks for the tokeniser and the symbol table. Every case
+ * reports ns, allocations and bytes allocated per operation, one tab
+ * separated line per case so that runs can be kept and compared
+ *
+ * Allocations are counted by linking with -Wl,--wrap for each of the
+ * allocation functions the shell calls (see the Makefile), so only
+ * calls made from our own code are counted, not those inside libc
+ *
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arena.h"
+#include "tokenise.h"
+#include "symtab.h"
+
+#define SZ(t) (sizeof(t) / sizeof(t[0]))
+
+/*
+ * Allocation counting
+ */
+static unsigned long allocs;
+static unsigned long bytes;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *s);
+
+void *
+__wrap_malloc(size_t size)
+{
+  allocs++;
+  bytes += size;
+  return __real_malloc(size);
+}
+
+void *
+__wrap_calloc(size_t nmemb, size_t size)
+{
+  allocs++;
+  bytes += nmemb * size;
+  return __real_calloc(nmemb, size);
+}
+
+void *
+__wrap_realloc(void *ptr, size_t size)
+{
+  allocs++;
+  bytes += size;
+  return __real_realloc(ptr, size);
+}
+
+char *
+__wrap_strdup(const char *s)
+{
+  allocs++;
+  bytes += strlen(s) + 1;
+  return __real_strdup(s);
+}
+
+static double
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * A case runs ops operations each time it is called, with whatever
+ * setup it needs done by prepare() outside the timing
+ */
+typedef struct {
+  const char *group;
+  const char *name;
+  void (* prepare)(void *arg);
+  long (* run)(void *arg);        // Returns the number of operations
+  void (* cleanup)(void *arg);
+  void *arg;
+} case_t;
+
+#define ROUNDS      5
+#define MIN_NS      20e6          // Per round
+
+static void
+measure(case_t *c)
+{
+  double best = 0;
+  unsigned long a = 0, b = 0;       // Over every round
+  long ops = 0;
+  int round;
+
+  for (round = 0; round < ROUNDS; round++) {
+    double elapsed = 0;
+    long n = 0;
+
+    while (elapsed < MIN_NS) {
+      unsigned long a0, b0;
+      double start;
+      if (c->prepare) {
+        c->prepare(c->arg);
+      }
+      a0 = allocs;
+      b0 = bytes;
+      start = now();
+      n += c->run(c->arg);
+      elapsed += now() - start;
+      a += allocs - a0;
+      b += bytes - b0;
+      if (c->cleanup) {
+        c->cleanup(c->arg);
+      }
+    }
+    if (round == 0 || elapsed / n < best) {
+      best = elapsed / n;
+    }
+    ops += n;
+  }
+  printf("%s\t%s\t%.1f\t%.2f\t%.1f\n", c->group, c->name, best,
+         (double)a / ops, (double)b / ops);
+}
+
+/*
+ * Tokeniser corpora
+ */
+typedef struct {
+  const char *line;
+  int count;
+  token_t **tokens;
+} line_t;
+
+static const char *realistic[] = {
+  "ls",
+  "ls -l /usr/bin",
+  "uname -a | cat | wc -l",
+  "PS1=\"% \"",
+  "cat < outfile.txt | cat > /dev/tty",
+  "grep -n \"static int\" *.c | sort -u >> matches.txt &",
+  "A=1 B=x ls --color=auto \"a \"'b' = c\\ d < in.txt|sort -u >> out.txt&",
+  "gcc -g -O0 -Wall -DLSH_ENABLE_CD -DLSH_ENABLE_ENV -DLSH_ENABLE_EXTERNAL -o lsh lsh.o tokenise.o symtab.o",
+};
+
+static char *
+repeat(const char *piece, size_t size)
+{
+  size_t len = strlen(piece), n = 0;
+  char *s = __real_malloc(size + len + 1);
+  while (n < size) {
+    memcpy(&s[n], piece, len);
+    n += len;
+  }
+  s[n] = '\0';
+  return s;
+}
+
+static long
+fetch_free(void *arg)
+{
+  line_t *lines = arg;
+  long ops = 0;
+  int i;
+
+  for (i = 0; lines[i].line; i++, ops++) {
+    int count;
+    token_t **tokens = tokenise_fetch(lines[i].line, &count);
+    tokenise_free(tokens, count);
+  }
+  return ops;
+}
+
+static void
+fetch_only_cleanup(void *arg)
+{
+  line_t *lines = arg;
+  int i;
+  for (i = 0; lines[i].line; i++) {
+    tokenise_free(lines[i].tokens, lines[i].count);
+  }
+}
+
+static long
+fetch_only(void *arg)
+{
+  line_t *lines = arg;
+  long ops = 0;
+  int i;
+  for (i = 0; lines[i].line; i++, ops++) {
+    lines[i].tokens = tokenise_fetch(lines[i].line, &lines[i].count);
+  }
+  return ops;
+}
+
+static void
+free_only_prepare(void *arg)
+{
+  (void)fetch_only(arg);
+}
+
+static long
+free_only(void *arg)
+{
+  line_t *lines = arg;
+  long ops = 0;
+  int i;
+  for (i = 0; lines[i].line; i++, ops++) {
+    tokenise_free(lines[i].tokens, lines[i].count);
+  }
+  return ops;
+}
+
+/*
+ * What the shell itself does: views of a line in an arena that is
+ * reset after each one
+ */
+static long
+views(void *arg)
+{
+  static arena_t arena;
+  static char buf[1 << 20];
+  line_t *lines = arg;
+  long ops = 0;
+  int i;
+
+  for (i = 0; lines[i].line; i++, ops++) {
+    int count;
+    size_t len = strlen(lines[i].line);
+    memcpy(buf, lines[i].line, len);
+    (void)tokenise_views(&arena, buf, len, &count);
+    arena_reset(&arena);
+  }
+  return ops;
+}
+
+static line_t *
+corpus(const char **text, int n)
+{
+  line_t *lines = calloc(n + 1, sizeof(line_t));
+  int i;
+  for (i = 0; i < n; i++) {
+    lines[i].line = text[i];
+  }
+  return lines;
+}
+
+/*
+ * Symbol table cases over a table of a given number of names
+ */
+typedef struct {
+  int size;
+  char **names;
+  char **misses;
+  symtab_t *table;
+} table_t;
+
+static char **
+names(int n, const char *prefix)
+{
+  char **names = __real_malloc(n * sizeof(char *));
+  char buf[512];
+  int i;
+  for (i = 0; i < n; i++) {
+    snprintf(buf, sizeof(buf), "%s%d", prefix, i);
+    names[i] = __real_strdup(buf);
+  }
+  return names;
+}
+
+static void
+fill(table_t *t)
+{
+  int i;
+  for (i = 0; i < t->size; i++) {
+    t->table = symtab_set(t->table, t->names[i], SYM_VAR, "value");
+  }
+}
+
+static void
+empty(void *arg)
+{
+  table_t *t = arg;
+  symtab_free(t->table);
+  t->table = NULL;
+}
+
+static void
+filled(void *arg)
+{
+  table_t *t = arg;
+  if (!t->table) {
+    fill(t);
+  }
+}
+
+static long
+set_new(void *arg)
+{
+  table_t *t = arg;
+  fill(t);
+  return t->size;
+}
+
+static long
+set_update(void *arg)
+{
+  table_t *t = arg;
+  int i;
+  for (i = 0; i < t->size; i++) {
+    t->table = symtab_set(t->table, t->names[i], SYM_VAR, "other value");
+  }
+  return t->size;
+}
+
+static long
+set_int(void *arg)
+{
+  table_t *t = arg;
+  int i;
+  for (i = 0; i < t->size; i++) {
+    t->table = symtab_set_int(t->table, t->names[i], i);
+  }
+  return t->size;
+}
+
+static long
+array_append(void *arg)
+{
+  table_t *t = arg;
+  int i;
+  for (i = 0; i < t->size; i++) {
+    t->table = symtab_append(t->table, "ARGS", 1, &t->names[i]);
+  }
+  return t->size;
+}
+
+static long
+lookup_hit(void *arg)
+{
+  table_t *t = arg;
+  int i;
+  for (i = 0; i < t->size; i++) {
+    if (!symtab_lookup(t->table, t->names[i])) {
+      abort();
+    }
+  }
+  return t->size;
+}
+
+static long
+lookup_miss(void *arg)
+{
+  table_t *t = arg;
+  int i;
+  for (i = 0; i < t->size; i++) {
+    if (symtab_lookup(t->table, t->misses[i])) {
+      abort();
+    }
+  }
+  return t->size;
+}
+
+static long
+fetch(void *arg)
+{
+  table_t *t = arg;
+  int i;
+  for (i = 0; i < t->size; i++) {
+    (void)symtab_fetch(t->table, t->names[i], "");
+  }
+  return t->size;
+}
+
+static table_t *
+table(int size, const char *prefix)
+{
+  table_t *t = calloc(1, sizeof(table_t));
+  t->size = size;
+  t->names = names(size, prefix);
+  t->misses = names(size, "MISSING_");
+  return t;
+}
+
+int main(int argc, char *argv[])
+{
+  static const char *adversarial[5];
+  case_t cases[64];
+  int n = 0, i;
+
+  adversarial[0] = repeat("a ", 64 * 1024);                // Many tiny tokens
+  adversarial[1] = repeat("x", 64 * 1024);                 // One huge token
+  adversarial[2] = repeat("|&<>=", 64 * 1024);             // All specials
+  adversarial[3] = repeat("\\ ", 64 * 1024);               // All escapes
+  adversarial[4] = repeat("\"quoted string \" ", 64 * 1024);
+
+  line_t *real = corpus(realistic, SZ(realistic));
+  line_t *hard = corpus(adversarial, SZ(adversarial));
+
+#define CASE(g, nm, p, r, c, a) \
+  cases[n++] = (case_t){ g, nm, p, r, c, a }
+
+  CASE("tokenise", "fetch+free realistic", NULL, fetch_free, NULL, real);
+  CASE("tokenise", "fetch realistic", NULL, fetch_only, fetch_only_cleanup, real);
+  CASE("tokenise", "free realistic", free_only_prepare, free_only, NULL, real);
+  CASE("tokenise", "views realistic", NULL, views, NULL, real);
+  CASE("tokenise", "fetch+free adversarial", NULL, fetch_free, NULL, hard);
+  CASE("tokenise", "views adversarial", NULL, views, NULL, hard);
+
+  int sizes[] = { 16, 1000, 100000 };
+  for (i = 0; i < SZ(sizes); i++) {
+    static char groups[SZ(sizes)][32];
+    table_t *t = table(sizes[i], "VAR_");
+    snprintf(groups[i], sizeof(groups[i]), "symtab/%d", sizes[i]);
+    CASE(groups[i], "set new", empty, set_new, empty, t);
+    CASE(groups[i], "set update", filled, set_update, NULL, t);
+    CASE(groups[i], "lookup hit", filled, lookup_hit, NULL, t);
+    CASE(groups[i], "lookup miss", filled, lookup_miss, NULL, t);
+    CASE(groups[i], "fetch", filled, fetch, NULL, t);
+    CASE(groups[i], "set int", filled, set_int, NULL, t);
+    CASE(groups[i], "array append", empty, array_append, empty, t);
+  }
+  // Long names that differ only at the very end
+  static char prefix[257];
+  memset(prefix, 'P', sizeof(prefix) - 1);
+  table_t *t = table(1000, prefix);
+  CASE("symtab/1000 long names", "set new", empty, set_new, empty, t);
+  CASE("symtab/1000 long names", "lookup hit", filled, lookup_hit, NULL, t);
+
+  printf("group\tcase\tns/op\tallocs/op\tbytes/op\n");
+  for (i = 0; i < n; i++) {
+    if (argc < 2 || strstr(cases[i].group, argv[1])) {
+      measure(&cases[i]);
+    }
+  }
+  exit(0);
+}
@@ -0,0 +1,31 @@
+#!/bin/sh
+# vim: set ts=2 sw=2 expandtab:
+#
+# A batch of short commands run through the parallel internal command
+# and through xargs -P, one sh -c per command, as lsh scripts used to
+#
+# usage: bench/parallel.sh [lsh binary] [commands] [jobs]
+
+LSH=${1:-./lsh}
+COMMANDS=${2:-2000}
+JOBS=${3:-$(nproc)}
+DIR=$(mktemp -d)
+trap 'rm -rf $DIR' EXIT
+
+now() {
+  date +%s%N
+}
+
+awk -v n=$COMMANDS 'BEGIN { for (i = 0; i < n; i++) printf "/bin/true %d\n", i }' > $DIR/batch
+
+run() {
+  start=$(now)
+  $LSH -c "$2" > /dev/null
+  ms=$(( ($(now) - start) / 1000000 ))
+  printf "%-12s %6d commands %6d ms %8d commands/sec\n" "$1" $COMMANDS $ms \
+         $(( COMMANDS * 1000 / (ms > 0 ? ms : 1) ))
+}
+
+run parallel "parallel -j $JOBS $DIR/batch"
+run "parallel -g" "parallel -g -j $JOBS $DIR/batch"
+run xargs "xargs -P $JOBS -I{} sh -c {} < $DIR/batch"
@@ -0,0 +1,47 @@
+#!/bin/sh
+# vim: set ts=2 sw=2 expandtab:
+#
+# Pipeline throughput: the same pipelines run by lsh, by lsh with
+# bigger pipe buffers and by /bin/sh
+#
+# usage: bench/pipeline.sh [lsh binary] [megabytes]
+
+LSH=${1:-./lsh}
+MB=${2:-1024}
+RUNS=3
+BIG=1048576
+
+now() {
+  date +%s%N
+}
+
+# Best of $RUNS wall clock times, in ms, of running $2 under shell $1
+best() {
+  best=
+  for i in $(seq $RUNS); do
+    start=$(now)
+    $1 -c "$2" > /dev/null
+    ms=$(( ($(now) - start) / 1000000 ))
+    if [ -z "$best" ] || [ $ms -lt $best ]; then
+      best=$ms
+    fi
+  done
+  echo $best
+}
+
+report() {
+  ms=$(best "$1" "$3")
+  printf "%-14s %6d ms %8d MB/s\n" "$2" $ms $(( MB * 1000 / (ms > 0 ? ms : 1) ))
+}
+
+for pipeline in \
+    "head -c ${MB}M /dev/zero | wc -c" \
+    "head -c ${MB}M /dev/zero | cat | cat | wc -c" \
+    "head -c ${MB}M /dev/zero | cat | cat | cat | cat | cat | wc -c"; do
+  echo "$pipeline"
+  report $LSH lsh "$pipeline"
+  report $LSH "lsh (1M pipes)" "LSH_PIPESIZE=$BIG
+$pipeline"
+  report /bin/sh /bin/sh "$pipeline"
+  echo
+done
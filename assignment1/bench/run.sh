@@ -0,0 +1,64 @@
+#!/bin/sh
+# vim: set ts=2 sw=2 expandtab:
+#
+# End to end benchmark. Generates a script for each kind of workload,
+# runs it through an lsh built with LSH_ENABLE_PHASES and shows where
+# the time per line went
+#
+# usage: bench/run.sh [lsh binary]
+
+LSH=${1:-./lsh-bench}
+DIR=$(mktemp -d)
+trap 'rm -rf $DIR' EXIT
+
+# generate <name> <lines> <awk program printing line i>
+generate() {
+  awk -v n=$2 "BEGIN { for (i = 0; i < n; i++) { $3 } }" > $DIR/$1.lsh
+}
+
+generate builtin 100000 'print "cd ."'
+generate assign 100000 'printf "V%d=%d NAME=\"quoted value %d\"\n", i % 100, i, i'
+generate external 2000 'print "true"'
+generate mixed 20000 'if (i % 10 == 0) print "true"; else printf "X=%d cd .\n", i'
+generate longargs 200 'printf "cd ."; for (j = 0; j < 10000; j++) printf " argument%d", j; print ""'
+
+for workload in builtin assign external mixed longargs; do
+  echo "== $workload ($(wc -l < $DIR/$workload.lsh) lines)"
+  $LSH $DIR/$workload.lsh > /dev/null
+  echo
+done
+
+echo "== builtin read from a pipe"
+$LSH < $DIR/builtin.lsh > /dev/null
+echo
+
+echo "== builtins against the same commands run externally"
+LSH_PHASES=/dev/null $(dirname $0)/builtins.sh $LSH
+echo
+
+echo "== arithmetic in the shell against expr"
+LSH_PHASES=/dev/null $(dirname $0)/arith.sh $LSH
+echo
+
+echo "== pipelines"
+LSH_PHASES=/dev/null $(dirname $0)/pipeline.sh $LSH 256
+echo
+
+echo "== parallel against xargs -P"
+LSH_PHASES=/dev/null $(dirname $0)/parallel.sh $LSH
+echo
+
+echo "== starting commands as the shell grows"
+LSH_PHASES=/dev/null $(dirname $0)/spawn.sh $LSH 200
+echo
+
+echo "== a script run again, parsed against cached"
+LSH_PHASES=/dev/null $(dirname $0)/cache.sh $LSH
+echo
+
+echo "== a function called against its body written out each time"
+LSH_PHASES=/dev/null $(dirname $0)/func.sh $LSH
+echo
+
+echo "== a loop against the same lines unrolled"
+LSH_PHASES=/dev/null $(dirname $0)/loop.sh $LSH
@@ -0,0 +1,43 @@
+#!/bin/sh
+# vim: set ts=2 sw=2 expandtab:
+#
+# Time to start a command as the shell grows. The same externals are
+# run by each spawn method after the shell has been filled with a
+# number of variables, less the time taken to set those up
+#
+# usage: bench/spawn.sh [lsh binary] [commands]
+
+LSH=${1:-./lsh}
+COMMANDS=${2:-1000}
+DIR=$(mktemp -d)
+trap 'rm -rf $DIR' EXIT
+
+now() {
+  date +%s%N
+}
+
+# Best of 3 wall clock times, in ms, of running $2 with LSH_SPAWN=$1
+best() {
+  best=
+  for i in 1 2 3; do
+    start=$(now)
+    LSH_SPAWN=$1 $LSH $2 > /dev/null
+    ms=$(( ($(now) - start) / 1000000 ))
+    if [ -z "$best" ] || [ $ms -lt $best ]; then
+      best=$ms
+    fi
+  done
+  echo $best
+}
+
+for vars in 0 100000 1000000; do
+  awk -v n=$vars 'BEGIN { for (i = 0; i < n; i++) printf "V%d=\"some value or other %d\"\n", i, i }' > $DIR/setup.lsh
+  cp $DIR/setup.lsh $DIR/run.lsh
+  awk -v n=$COMMANDS 'BEGIN { for (i = 0; i < n; i++) print "/bin/true" }' >> $DIR/run.lsh
+  echo "$vars variables"
+  for method in fork vfork posix_spawn zygote; do
+    base=$(best $method $DIR/setup.lsh)
+    ms=$(( $(best $method $DIR/run.lsh) - base ))
+    printf "  %-12s %6d us/command\n" $method $(( ms * 1000 / COMMANDS ))
+  done
+done
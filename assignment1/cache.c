@@ -0,0 +1,575 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * Scripts kept parsed from one run to the next
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <libgen.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "arena.h"
+#include "parse.h"
+#include "cache.h"
+
+#ifdef LSH_ENABLE_CACHE
+
+/*
+ * The first time a script is run every line of it is parsed and the
+ * pipelines written out to .<name>.lshc beside it. After that, for as
+ * long as neither the script nor lsh itself has changed, the cache is
+ * mapped instead and each pipeline is rebuilt in the arena from it
+ * just before it is run, with its words left where they lie in the
+ * mapping, so nothing is tokenised or parsed again.
+ *
+ * Parsing a line depends on nothing but its text, so this is safe.
+ * Blank lines and comments are left out altogether, and a line with a
+ * syntax error is kept as text so that it is reported just where it
+ * would have been. What a command name resolves to is not kept, since
+ * that depends on the PATH of the run, and the hash finds it quickly.
+ *
+ * Every string is its length, its bytes and a NUL, so that the words
+ * can be used where they lie. The header is written as it is held, so
+ * a cache is only any good on the machine that wrote it, which is all
+ * it is for. There is no version of lsh to key
+ * the cache by, so the size and mtime of the lsh binary stand in for one.
+ *
+ * Everything in the key can be found out with stat(), so it says
+ * nothing about who wrote the cache. Only a cache that we own and that
+ * nobody else can write to is used, and only in a directory nobody else
+ * can put one in
+ */
+#define MAGIC "LSHC"
+#define FORMAT 3
+
+#define NONE UINT32_MAX         // The length of a string that is NULL
+
+enum {
+  R_PIPELINE = 'P',
+  R_TEXT = 'T'                  // To be parsed when it is run
+};
+
+typedef struct {
+  char magic[4];
+  uint32_t format;
+  int64_t lsh_size;             // Of the lsh that wrote it
+  int64_t lsh_mtime;
+  uint64_t dev;                 // Of the script
+  uint64_t ino;
+  int64_t size;
+  int64_t mtime;
+  int64_t mtime_ns;
+  uint32_t pathlen;             // Of the script's real path, which follows
+  uint32_t length;              // Of the records after that
+} header_t;
+
+struct cache {
+  char *map;
+  size_t size;
+  const char *p;                // The next record
+  const char *end;
+  int bad;                      // A record ran past the end
+};
+
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t size;
+} out_t;
+
+/*
+ * The header a cache of the script must have, and where that cache is
+ */
+static int
+key(const char *file, const struct stat *st, header_t *header, char *path,
+    char *name)
+{
+  struct stat self;
+  char *copy, *base, *dir;
+
+  if (!realpath(file, path) || stat("/proc/self/exe", &self) < 0) {
+    return -1;
+  }
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, MAGIC, sizeof(header->magic));
+  header->format = FORMAT;
+  header->lsh_size = self.st_size;
+  header->lsh_mtime = self.st_mtime;
+  header->dev = st->st_dev;
+  header->ino = st->st_ino;
+  header->size = st->st_size;
+  header->mtime = st->st_mtim.tv_sec;
+  header->mtime_ns = st->st_mtim.tv_nsec;
+  header->pathlen = strlen(path);
+
+  // dirname() and basename() may both write to what they are given
+  copy = strdup(path);
+  base = strdup(path);
+  dir = dirname(copy);
+  snprintf(name, PATH_MAX, "%s/.%s.lshc", strcmp(dir, "/") ? dir : "",
+           basename(base));
+  free(copy);
+  free(base);
+  return 0;
+}
+
+/*
+ * Whether caches in the directory of the cache called name can be
+ * trusted: nobody but its owner can write to it, or it is sticky, as
+ * /tmp is, and it is ours. Anyone who could put a cache there could
+ * have any commands they liked run as whoever runs the script
+ */
+static int
+trusted(const char *name)
+{
+  struct stat st;
+  char *copy = strdup(name);
+  int ok = stat(dirname(copy), &st) == 0 &&
+           (!(st.st_mode & (S_IWGRP | S_IWOTH)) ||
+            ((st.st_mode & S_ISVTX) && st.st_uid == geteuid()));
+
+  free(copy);
+  return ok;
+}
+
+/*
+ * Numbers are written seven bits to a byte, least significant first,
+ * with the top bit set on every byte but the last
+ */
+static uint32_t
+get(cache_t *cache)
+{
+  uint32_t n = 0;
+  int shift;
+
+  for (shift = 0; shift < 35; shift += 7) {
+    unsigned char c;
+    if (cache->p == cache->end) {
+      break;
+    }
+    c = *cache->p++;
+    n |= (uint32_t)(c & 0x7f) << shift;
+    if (!(c & 0x80)) {
+      return n;
+    }
+  }
+  cache->bad = 1;
+  return 0;
+}
+
+static char *
+get_string(cache_t *cache)
+{
+  uint32_t len = get(cache);
+  char *s = (char *)cache->p;
+
+  if (len == NONE || cache->bad) {
+    return NULL;
+  }
+  if ((size_t)(cache->end - cache->p) <= len || s[len] != '\0') {
+    cache->bad = 1;
+    return NULL;
+  }
+  cache->p += len + 1;
+  return s;
+}
+
+/*
+ * A count of things each at least a byte long, which there must be
+ * room left for
+ */
+static int
+get_count(cache_t *cache)
+{
+  uint32_t n = get(cache);
+
+  if (n > (size_t)(cache->end - cache->p)) {
+    cache->bad = 1;
+    return 0;
+  }
+  return n;
+}
+
+static char **
+get_words(cache_t *cache, arena_t *arena, int count)
+{
+  char **words = arena_alloc(arena, (count + 1) * sizeof(char *));
+  int i;
+
+  for (i = 0; i < count; i++) {
+    if (!(words[i] = get_string(cache))) {
+      cache->bad = 1;
+    }
+  }
+  words[count] = NULL;
+  return words;
+}
+
+/*
+ * Build the pipeline at the next record in the arena
+ */
+static pipeline_t *
+thaw(cache_t *cache, arena_t *arena)
+{
+  pipeline_t *pipeline = arena_calloc(arena, 1, sizeof(pipeline_t));
+  command_t **tail = &pipeline->commands;
+  int i, j;
+
+  pipeline->background = get(cache);
+  pipeline->keyword = get(cache);
+  pipeline->ready = get(cache);
+  if (pipeline->keyword > K_DONE) {
+    cache->bad = 1;
+  }
+  pipeline->stages = get_count(cache);
+  for (i = 0; i < pipeline->stages && !cache->bad; i++) {
+    command_t *command = arena_calloc(arena, 1, sizeof(command_t));
+
+    command->append = get(cache);
+    command->expand = get(cache);
+    command->from = get_string(cache);
+    command->to = get_string(cache);
+    command->nassigns = get_count(cache);
+    if (command->nassigns) {
+      command->assigns = arena_calloc(arena, command->nassigns, sizeof(assign_t));
+    }
+    for (j = 0; j < command->nassigns && !cache->bad; j++) {
+      assign_t *assign = &command->assigns[j];
+      assign->name = get_string(cache);
+      assign->append = get(cache);
+      assign->value = get_string(cache);
+      if (!assign->value) {
+        assign->nitems = get_count(cache);
+        assign->items = get_words(cache, arena, assign->nitems);
+      }
+    }
+    command->argc = get_count(cache);
+    command->argv = get_words(cache, arena, command->argc);
+    *tail = command;
+    tail = &command->next;
+  }
+  return pipeline;
+}
+
+/*
+ * Get the next line of the script, either as a pipeline ready to run
+ * or as text in the arena to be parsed, which may be overwritten at
+ * line[len]. Returns 0 at the end and -1 if the cache is corrupt,
+ * which once it has been loaded it can't be
+ */
+int
+cache_next(cache_t *cache, arena_t *arena, pipeline_t **pipeline,
+           char **line, size_t *len)
+{
+  *pipeline = NULL;
+  *line = NULL;
+  if (cache->p == cache->end) {
+    return 0;
+  }
+  switch (get(cache)) {
+  case R_PIPELINE:
+    *pipeline = thaw(cache, arena);
+    break;
+  case R_TEXT:
+    if ((*line = get_string(cache)) != NULL) {
+      *len = strlen(*line);
+      *line = arena_strndup(arena, *line, *len);
+    } else {
+      cache->bad = 1;
+    }
+    break;
+  default:
+    cache->bad = 1;
+    break;
+  }
+  return cache->bad ? -1 : 1;
+}
+
+void
+cache_free(cache_t *cache)
+{
+  munmap(cache->map, cache->size);
+  free(cache);
+}
+
+/*
+ * Whether a pipeline read back is one that parsing could have given:
+ * a keyword that stands alone has no commands, anything else has at
+ * least one and none of them is empty. A record cut short by a crash
+ * can decode to something else, which must not get as far as running
+ */
+static int
+whole(pipeline_t *pipeline)
+{
+  command_t *command;
+  int alone = pipeline->keyword == K_CLOSE || pipeline->keyword == K_THEN ||
+              pipeline->keyword == K_ELSE || pipeline->keyword == K_FI ||
+              pipeline->keyword == K_DO || pipeline->keyword == K_DONE;
+
+  if (alone ? pipeline->stages != 0 : pipeline->stages < 1) {
+    return 0;
+  }
+  for (command = pipeline->commands; command; command = command->next) {
+    if (command->argc < 0 || (command->argc == 0 && command->nassigns == 0 &&
+                              !command->from && !command->to)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Read every record, to be sure they can all be run. Returns -1 if
+ * any can't
+ */
+static int
+check(cache_t *cache)
+{
+  const char *start = cache->p;
+  arena_t arena = { 0 };
+  pipeline_t *pipeline;
+  char *line;
+  size_t len;
+  int more;
+
+  while ((more = cache_next(cache, &arena, &pipeline, &line, &len)) > 0) {
+    if (pipeline && !whole(pipeline)) {
+      more = -1;
+      break;
+    }
+    arena_reset(&arena);
+  }
+  arena_free(&arena);
+  cache->p = start;
+  return more;
+}
+
+/*
+ * Map the cache of the script if it has one that is still good.
+ * Returns NULL if it has not, when it must be parsed. Every record is
+ * read through first, so a script is never left half run by one that
+ * turns out to be corrupt
+ */
+cache_t *
+cache_load(const char *file, const struct stat *st)
+{
+  char path[PATH_MAX], name[PATH_MAX];
+  header_t want, *header;
+  struct stat cst;
+  cache_t *cache;
+  char *map;
+  int fd;
+
+  if (key(file, st, &want, path, name) < 0 || !trusted(name) ||
+      (fd = open(name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW)) < 0) {
+    return NULL;
+  }
+  // Only a cache we wrote ourselves, that nobody else can have changed
+  if (fstat(fd, &cst) < 0 || !S_ISREG(cst.st_mode) || cst.st_uid != geteuid() ||
+      cst.st_mode & (S_IWGRP | S_IWOTH) ||
+      (size_t)cst.st_size < sizeof(header_t)) {
+    close(fd);
+    return NULL;
+  }
+  // Private and writable, as the text of a line read any other way is
+  map = mmap(NULL, cst.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+  header = (header_t *)map;
+  if (memcmp(header, &want, offsetof(header_t, length)) != 0 ||
+      sizeof(header_t) + want.pathlen + 1 + header->length != (size_t)cst.st_size ||
+      memcmp(map + sizeof(header_t), path, want.pathlen + 1) != 0) {
+    munmap(map, cst.st_size);
+    return NULL;
+  }
+  (void)madvise(map, cst.st_size, MADV_SEQUENTIAL);
+
+  cache = calloc(1, sizeof(cache_t));
+  cache->map = map;
+  cache->size = cst.st_size;
+  cache->p = map + sizeof(header_t) + want.pathlen + 1;
+  cache->end = map + cst.st_size;
+  if (check(cache) < 0) {
+    cache_free(cache);
+    return NULL;
+  }
+  return cache;
+}
+
+static void
+put(out_t *out, const void *p, size_t n)
+{
+  if (out->len + n > out->size) {
+    out->size = (out->len + n) * 2;
+    out->buf = realloc(out->buf, out->size);
+  }
+  memcpy(&out->buf[out->len], p, n);
+  out->len += n;
+}
+
+static void
+put_num(out_t *out, uint32_t n)
+{
+  unsigned char c;
+
+  for (; n >= 0x80; n >>= 7) {
+    c = (n & 0x7f) | 0x80;
+    put(out, &c, 1);
+  }
+  c = n;
+  put(out, &c, 1);
+}
+
+static void
+put_string(out_t *out, const char *s, size_t len)
+{
+  if (!s) {
+    put_num(out, NONE);
+    return;
+  }
+  put_num(out, len);
+  put(out, s, len);
+  put(out, "", 1);
+}
+
+#define PUT_STRING(out, s) put_string(out, s, (s) ? strlen(s) : 0)
+
+static void
+put_words(out_t *out, char **words, int count)
+{
+  int i;
+
+  put_num(out, count);
+  for (i = 0; i < count; i++) {
+    PUT_STRING(out, words[i]);
+  }
+}
+
+static void
+freeze(out_t *out, pipeline_t *pipeline)
+{
+  command_t *command;
+  int i;
+
+  put_num(out, R_PIPELINE);
+  put_num(out, pipeline->background);
+  put_num(out, pipeline->keyword);
+  put_num(out, pipeline->ready);
+  put_num(out, pipeline->stages);
+  for (command = pipeline->commands; command; command = command->next) {
+    put_num(out, command->append);
+    put_num(out, command->expand);
+    PUT_STRING(out, command->from);
+    PUT_STRING(out, command->to);
+    put_num(out, command->nassigns);
+    for (i = 0; i < command->nassigns; i++) {
+      assign_t *assign = &command->assigns[i];
+      PUT_STRING(out, assign->name);
+      put_num(out, assign->append);
+      PUT_STRING(out, assign->value);
+      if (!assign->value) {
+        put_words(out, assign->items, assign->nitems);
+      }
+    }
+    put_words(out, command->argv, command->argc);
+  }
+}
+
+/*
+ * Parse the len bytes of the script's text, which are not changed, and
+ * write the cache of it. Nothing is said if the cache can't be written,
+ * the script is just parsed again next time
+ */
+void
+cache_save(const char *file, const struct stat *st, const char *text,
+           size_t len)
+{
+  char path[PATH_MAX], name[PATH_MAX], temp[PATH_MAX + 16];
+  char *copy, *dir, *line, *end, *nl;
+  header_t header;
+  out_t out = { 0 };
+  arena_t arena = { 0 };
+  int fd, ok;
+
+  if (key(file, st, &header, path, name) < 0) {
+    return;
+  }
+  copy = strdup(name);
+  dir = dirname(copy);
+  ok = access(dir, W_OK) == 0 && trusted(name);
+  free(copy);
+  if (!ok) {
+    return;
+  }
+
+  put(&out, &header, sizeof(header));
+  put(&out, path, header.pathlen + 1);
+
+  // Parsing writes into the text so it is done on a copy
+  copy = malloc(len + 1);
+  memcpy(copy, text, len);
+  for (line = copy, end = copy + len; line < end; line = nl + 1) {
+    size_t n, skip;
+    const char *error;
+    pipeline_t *pipeline;
+
+    nl = memchr(line, '\n', end - line);
+    if (!nl) {
+      nl = end;
+    }
+    for (skip = 0; line + skip < nl && isspace((unsigned char)line[skip]); skip++)
+      ;
+    n = nl - line - skip;
+    if (n == 0 || line[skip] == '#') {
+      continue;
+    }
+    pipeline = parse_pipeline(&arena, line + skip, n, &error);
+    if (pipeline) {
+      freeze(&out, pipeline);
+    } else {
+      put_num(&out, R_TEXT);
+      put_string(&out, text + (line - copy) + skip, n);
+    }
+    arena_reset(&arena);
+  }
+  free(copy);
+  arena_free(&arena);
+  ((header_t *)out.buf)->length = out.len - sizeof(header) - header.pathlen - 1;
+
+  // Whoever reads it sees either the old cache or all of the new one
+  snprintf(temp, sizeof(temp), "%s.%d", name, (int)getpid());
+  fd = open(temp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd >= 0) {
+    ok = write(fd, out.buf, out.len) == (ssize_t)out.len;
+    if (close(fd) < 0 || !ok || rename(temp, name) < 0) {
+      unlink(temp);
+    }
+  }
+  free(out.buf);
+}
+#endif /* LSH_ENABLE_CACHE */
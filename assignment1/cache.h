@@ -0,0 +1,39 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * Compiled script cache interface
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+typedef struct cache cache_t;
+
+cache_t *
+cache_load(const char *file, const struct stat *st);
+
+int
+cache_next(cache_t *cache, arena_t *arena, pipeline_t **pipeline,
+           char **line, size_t *len);
+
+void
+cache_free(cache_t *cache);
+
+void
+cache_save(const char *file, const struct stat *st, const char *text,
+           size_t len);
@@ -0,0 +1,327 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * The environment passed on to commands (the 'export' and 'env'
+ * internal commands)
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/types.h>
+
+#include "symtab.h"
+#include "arena.h"
+#include "parse.h"
+#include "execute.h"
+#include "env.h"
+#include "lsh.h"
+
+/*
+ * The environment every external command is started with, built from
+ * the exported variables as NAME=value strings. Pointers and strings
+ * are one allocation, sorted so that env lists them in order. It is
+ * built again only once the symbol table generation shows an exported
+ * variable has changed, so starting a command usually costs nothing
+ * here at all
+ */
+static char **envp;
+static unsigned generation;
+static int built;
+
+typedef struct {
+  char **envp;
+  char *text;
+  int count;
+  size_t size;                  // Of all the strings
+} build_t;
+
+/*
+ * The value an exported variable passes on, or NULL. Arrays, as in
+ * bash, are not passed on
+ */
+static const char *
+exported(symbol_t *symbol)
+{
+  if (!symbol->exported || symbol->type == SYM_ARRAY) {
+    return NULL;
+  }
+  return symtab_string(symbol);
+}
+
+static void
+measure(symbol_t *symbol, void *arg)
+{
+  build_t *b = arg;
+  const char *value = exported(symbol);
+
+  if (value) {
+    b->count++;
+    b->size += strlen(symbol->name) + strlen(value) + 2;
+  }
+}
+
+static void
+fill(symbol_t *symbol, void *arg)
+{
+  build_t *b = arg;
+  const char *value = exported(symbol);
+
+  if (value) {
+    b->envp[b->count++] = b->text;
+    b->text += sprintf(b->text, "%s=%s", symbol->name, value) + 1;
+  }
+}
+
+static int
+compare(const void *a, const void *b)
+{
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+char **
+env_envp(void)
+{
+  build_t b = { NULL, NULL, 0, 0 };
+
+  if (built && generation == symtab_generation(symtab)) {
+    return envp;
+  }
+  symtab_walk(symtab, measure, &b);
+  free(envp);
+  envp = malloc((b.count + 1) * sizeof(char *) + b.size);
+  b.envp = envp;
+  b.text = (char *)&envp[b.count + 1];
+  b.count = 0;
+  symtab_walk(symtab, fill, &b);
+  envp[b.count] = NULL;
+  qsort(envp, b.count, sizeof(char *), compare);
+  generation = symtab_generation(symtab);
+  built = 1;
+  return envp;
+}
+
+static int
+identifier(const char *name, size_t len)
+{
+  size_t i;
+
+  if (len == 0 || (!isalpha((unsigned char)*name) && *name != '_')) {
+    return 0;
+  }
+  for (i = 1; i < len; i++) {
+    if (!isalnum((unsigned char)name[i]) && name[i] != '_') {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Take the shell's own environment as exported variables
+ */
+void
+env_import(char **vars)
+{
+  char name[256];
+
+  for (; *vars; vars++) {
+    const char *eq = strchr(*vars, '=');
+    size_t len = eq ? eq - *vars : 0;
+
+    if (len > 0 && len < sizeof(name) && identifier(*vars, len)) {
+      memcpy(name, *vars, len);
+      name[len] = '\0';
+      symtab = symtab_set(symtab, name, SYM_VAR, (char *)eq + 1);
+      symtab = symtab_export(symtab, name, 1);
+    }
+  }
+}
+
+/*
+ * The length of the name in a NAME=value string
+ */
+static size_t
+name_length(const char *var)
+{
+  const char *eq = strchr(var, '=');
+  return eq ? (size_t)(eq - var) : strlen(var);
+}
+
+static int
+same_name(const char *a, const char *b)
+{
+  size_t len = name_length(a);
+  return name_length(b) == len && strncmp(a, b, len) == 0;
+}
+
+/*
+ * The NAME=value strings in base with the n in vars added, in place of
+ * any for the same name and the last of them where vars has several,
+ * as a NULL terminated list from arena. The strings are not copied
+ */
+char **
+env_merge(arena_t *arena, char **base, char **vars, int n)
+{
+  char **merged, **e;
+  int count = 0, i, j;
+
+  for (e = base; *e; e++) {
+    count++;
+  }
+  merged = arena_alloc(arena, (count + n + 1) * sizeof(char *));
+  for (count = 0, e = base; *e; e++) {
+    // Leave out anything that is being given a new value
+    for (j = 0; j < n && !same_name(vars[j], *e); j++)
+      ;
+    if (j == n) {
+      merged[count++] = *e;
+    }
+  }
+  for (i = 0; i < n; i++) {
+    for (j = i + 1; j < n && !same_name(vars[j], vars[i]); j++)
+      ;
+    if (j == n) {
+      merged[count++] = vars[i];
+    }
+  }
+  merged[count] = NULL;
+  return merged;
+}
+
+/*
+ * export [-n] [name[=value] ...]
+ *
+ * Pass each name on to commands, first setting it if a value is given.
+ * -n stops passing them on instead. With no names list what is passed
+ */
+int
+lsh_export(int argc, char **argv)
+{
+  int exported = 1, status = 0, i = 1;
+
+  if (i < argc && strcmp(argv[i], "-n") == 0) {
+    exported = 0;
+    i++;
+  } else if (i < argc && strcmp(argv[i], "-p") == 0) {
+    i++;
+  }
+  if (i == argc) {
+    char **e;
+    for (e = env_envp(); *e; e++) {
+      const char *p;
+      int len = name_length(*e);
+      // Single quoted so that it can be read back in
+      printf("export %.*s='", len, *e);
+      for (p = *e + len + 1; *p; p++) {
+        if (*p == '\'') {
+          printf("'\\''");
+        } else {
+          putchar(*p);
+        }
+      }
+      printf("'\n");
+    }
+    return 0;
+  }
+  for (; i < argc; i++) {
+    size_t len = name_length(argv[i]);
+    char *eq = argv[i][len] ? &argv[i][len] : NULL;
+
+    if (!identifier(argv[i], len)) {
+      fprintf(stderr, "%s: '%s': not a valid identifier\n", argv[0], argv[i]);
+      status = 1;
+      continue;
+    }
+    if (eq) {
+      *eq = '\0';
+      symtab = symtab_set(symtab, argv[i], SYM_VAR, eq + 1);
+    }
+    symtab = symtab_export(symtab, argv[i], exported);
+    if (eq) {
+      *eq = '=';
+    }
+  }
+  return status;
+}
+
+/*
+ * Start a command with an environment of our own making and wait for it
+ */
+static int
+run(char **argv, char **vars)
+{
+  int fds[3] = { -1, -1, -1 };
+  char *path;
+  pid_t pid;
+
+  if (strchr(argv[0], '/')) {
+    path = strdup(argv[0]);
+  } else {
+    path = path_lookup(symtab_fetch(symtab, "PATH", PATH), argv[0]);
+  }
+  if (!path) {
+    fprintf(stderr, "env: '%s': No such file or directory\n", argv[0]);
+    return 127;
+  }
+  fflush(stdout);
+  pid = execute_spawn(execute_method(symtab_fetch(symtab, "LSH_SPAWN", LSH_SPAWN)),
+                      path, argv, vars, fds, -1);
+  free(path);
+  if (pid < 0) {
+    perror(argv[0]);
+    return 126;
+  }
+  return execute_wait(pid, NULL, NULL);
+}
+
+/*
+ * env [-i] [name=value ...] [command [arg ...]]
+ *
+ * Run a command with the exported variables and the settings given,
+ * or with only the settings after -i. With no command list them
+ */
+int
+lsh_env(int argc, char **argv)
+{
+  char *none[] = { NULL };
+  char **base, **vars, **e;
+  arena_t arena = { 0 };
+  int i = 1, first, status = 0;
+
+  if (i < argc && strcmp(argv[i], "-i") == 0) {
+    i++;
+    base = none;
+  } else {
+    base = env_envp();
+  }
+  for (first = i; i < argc && strchr(argv[i], '='); i++)
+    ;
+  vars = env_merge(&arena, base, &argv[first], i - first);
+
+  if (i < argc) {
+    status = run(&argv[i], vars);
+  } else {
+    for (e = vars; *e; e++) {
+      printf("%s\n", *e);
+    }
+  }
+  arena_free(&arena);
+  return status;
+}
@@ -0,0 +1,37 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * Environment interface
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "arena.h"
+
+void
+env_import(char **vars);
+
+char **
+env_envp(void);
+
+char **
+env_merge(arena_t *arena, char **base, char **vars, int n);
+
+int
+lsh_export(int argc, char **argv);
+
+int
+lsh_env(int argc, char **argv);
@@ -0,0 +1,474 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * Launch external commands for the learning shell
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE             // For pipe2() and F_SETPIPE_SZ
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+
+#include "arena.h"
+#include "parse.h"
+#include "execute.h"
+#include "zygote.h"
+
+/*
+ * Set when we are an interactive shell that owns its terminal. Only
+ * then are jobs given process groups of their own and the terminal
+ */
+static int job_control;
+
+static const char *methods[] = {
+  [SPAWN_FORK]  = "fork",
+  [SPAWN_VFORK] = "vfork",
+  [SPAWN_POSIX] = "posix_spawn",
+  [SPAWN_ZYGOTE] = "zygote",
+};
+
+/*
+ * Take charge of the terminal if we are interactive. The shell must
+ * ignore the signals it would otherwise get for taking the terminal
+ * back from a job, and a ^Z meant for the job, though its children
+ * must not. A child shell that calls this again, not interactive,
+ * gives job control up
+ */
+void
+execute_init(int interactive)
+{
+  job_control = 0;
+  if (interactive && isatty(STDIN_FILENO) &&
+      tcgetpgrp(STDIN_FILENO) == getpgrp()) {
+    job_control = 1;
+    signal(SIGTTOU, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+  }
+}
+
+/*
+ * The process group to start a new job in: 0 for a group of its own
+ * or -1 to stay in ours when there is no job control
+ */
+pid_t
+execute_group(void)
+{
+  return job_control ? 0 : -1;
+}
+
+/*
+ * Give the terminal to the process group pgid
+ */
+void
+execute_foreground(pid_t pgid)
+{
+  if (job_control && pgid > 0) {
+    tcsetpgrp(STDIN_FILENO, pgid);
+  }
+}
+
+/*
+ * Map a method name onto a spawn method. Anything we don't recognise
+ * gets the traditional fork()
+ */
+spawn_t
+execute_method(const char *name)
+{
+  int i;
+  for (i = 0; name && i < sizeof(methods) / sizeof(methods[0]); i++) {
+    if (strcmp(name, methods[i]) == 0) {
+      return (spawn_t)i;
+    }
+  }
+  return SPAWN_FORK;
+}
+
+const char *
+execute_method_name(spawn_t method)
+{
+  return methods[method];
+}
+
+/*
+ * Search the specified path to locate an executable binary. Returns a
+ * dynamically allocated path or NULL (with errno set) if not found
+ */
+char *
+path_lookup(const char *path, const char *binary)
+{
+  char *p = strdup(path);
+  char *saveptr;
+  char *token;
+  int binlen = strlen(binary);
+  char *which = NULL;
+
+  for (token = strtok_r(p, ":", &saveptr);
+       token != NULL;
+       token = strtok_r(NULL, ":", &saveptr)) {
+    char *end;
+    while (isspace(*token)) {
+      token++;
+    }
+    for (end = token + strlen(token); end > token && isspace(end[-1]); end--)
+      ;
+    char *execpath = malloc((end - token) + binlen + 2);
+    memcpy(execpath, token, end - token);
+    execpath[end - token] = '/';
+    strcpy(&execpath[end - token + 1], binary);
+    struct stat statbuf;
+    /*
+     * Although we check for the file's existance here, it is
+     * not a guarantee, if found, that it will still exist by
+     * the time we attempt to execute it. For the same reason,
+     * there is no point in checking whether it is executable
+     * as that might change too.
+     */
+    if (stat(execpath, &statbuf) == 0) {
+      which = execpath;
+      break;
+    }
+    free(execpath);
+  }
+  free(p);
+  if (!which) {
+    errno = ENOENT;
+  }
+  return which;
+}
+
+/*
+ * Put a new child into its process group and install the redirected
+ * descriptors as its standard ones. The originals were opened
+ * close-on-exec so they vanish at the execve(). The shell blocks
+ * SIGCHLD to collect it from a signalfd, which the child must not
+ * inherit
+ */
+static void
+child_setup(pid_t pgid, int fds[3])
+{
+  sigset_t none;
+  int i;
+
+  if (pgid >= 0) {
+    setpgid(0, pgid);
+  }
+  if (job_control) {
+    signal(SIGTTOU, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+  }
+  sigemptyset(&none);
+  sigprocmask(SIG_SETMASK, &none, NULL);
+  for (i = 0; i < 3; i++) {
+    if (fds[i] >= 0 && fds[i] != i) {
+      dup2(fds[i], i);
+    }
+  }
+}
+
+/*
+ * The parent makes the same setpgid() as the child so that the group
+ * exists whichever of them runs first
+ */
+static void
+parent_setup(pid_t pid, pid_t pgid)
+{
+  if (pid > 0 && pgid >= 0) {
+    setpgid(pid, pgid ? pgid : pid);
+  }
+}
+
+/*
+ * Fork a child that will carry on running shell code rather than exec
+ * anything, such as an internal command in a pipeline. Returns as
+ * fork() does, with the child already set up as execute_spawn() would
+ */
+pid_t
+execute_fork(pid_t pgid, int fds[3])
+{
+  pid_t pid;
+
+  fflush(stdout);
+  pid = fork();
+  if (pid == 0) {
+    child_setup(pgid, fds);
+  }
+  parent_setup(pid, pgid);
+  return pid;
+}
+
+/*
+ * The classic fork() and execve(). The child reports its own exec
+ * failure and exits with errno as its status
+ */
+static pid_t
+spawn_fork(const char *path, char **argv, char **envp, int fds[3], pid_t pgid)
+{
+  pid_t pid = fork();
+  if (pid == 0) {
+    child_setup(pgid, fds);
+    execve(path, argv, envp);
+    /*
+     * Shouldn't get here if above has been successful
+     */
+    int error = errno;
+    perror(argv[0]);
+    /*
+     * The child must exit here if the exec failed, otherwise we would
+     * have another shell running. As with sh, 127 is not found
+     */
+    exit(error == ENOENT ? 127 : 126);
+  }
+  parent_setup(pid, pgid);
+  return pid;
+}
+
+/*
+ * vfork() borrows our address space until the child calls execve() or
+ * _exit() so there are no page tables to copy. The child must not
+ * touch anything but the error flag below, which we share with it
+ */
+static pid_t
+spawn_vfork(const char *path, char **argv, char **envp, int fds[3], pid_t pgid)
+{
+  static volatile int exec_errno;
+
+  exec_errno = 0;
+  pid_t pid = vfork();
+  if (pid == 0) {
+    child_setup(pgid, fds);
+    execve(path, argv, envp);
+    exec_errno = errno;
+    _exit(127);
+  }
+  if (pid > 0 && exec_errno) {
+    // The child has already exited but we must still reap it
+    (void)waitpid(pid, NULL, 0);
+    errno = exec_errno;
+    pid = -1;
+  }
+  parent_setup(pid, pgid);
+  return pid;
+}
+
+static pid_t
+spawn_posix(const char *path, char **argv, char **envp, int fds[3], pid_t pgid)
+{
+  posix_spawn_file_actions_t actions, *ap = NULL;
+  posix_spawnattr_t attr, *attrp = &attr;
+  short flags = POSIX_SPAWN_SETSIGMASK;
+  sigset_t none;
+  pid_t pid;
+  int i, rc;
+
+  // As child_setup() does
+  posix_spawnattr_init(attrp);
+  sigemptyset(&none);
+  posix_spawnattr_setsigmask(attrp, &none);
+  if (pgid >= 0) {
+    flags |= POSIX_SPAWN_SETPGROUP;
+    posix_spawnattr_setpgroup(attrp, pgid);
+  }
+  if (job_control) {
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGTTOU);
+    sigaddset(&defaults, SIGTTIN);
+    sigaddset(&defaults, SIGTSTP);
+    flags |= POSIX_SPAWN_SETSIGDEF;
+    posix_spawnattr_setsigdefault(attrp, &defaults);
+  }
+  posix_spawnattr_setflags(attrp, flags);
+
+  for (i = 0; i < 3; i++) {
+    if (fds[i] >= 0 && fds[i] != i) {
+      if (!ap) {
+        ap = &actions;
+        posix_spawn_file_actions_init(ap);
+      }
+      posix_spawn_file_actions_adddup2(ap, fds[i], i);
+    }
+  }
+  rc = posix_spawn(&pid, path, ap, attrp, argv, envp);
+  if (ap) {
+    posix_spawn_file_actions_destroy(ap);
+  }
+  posix_spawnattr_destroy(attrp);
+  if (rc != 0) {
+    errno = rc;
+    pid = -1;
+  }
+  return pid;
+}
+
+/*
+ * Start the binary at path in a new child process with fds[] (where not
+ * -1) as its standard input, output and error. The child joins process
+ * group pgid, or leads a new one if pgid is 0, or stays in ours if it
+ * is -1. Returns the pid of the child or -1 with errno set if it could
+ * not be started
+ */
+pid_t
+execute_spawn(spawn_t method, const char *path, char **argv, char **envp,
+              int fds[3], pid_t pgid)
+{
+  // Anything we have buffered must go out before the child's output
+  fflush(stdout);
+  switch (method) {
+  case SPAWN_VFORK: return spawn_vfork(path, argv, envp, fds, pgid);
+#ifdef LSH_ENABLE_ZYGOTE
+  case SPAWN_ZYGOTE: {
+    pid_t pid = zygote_spawn(path, argv, envp, fds, pgid);
+    if (pid >= 0 || errno != ENOSYS) {
+      return pid;
+    }
+    // No server, as in a forked copy of the shell or one started without
+  }
+  /* Fall through */
+#endif
+  case SPAWN_POSIX: return spawn_posix(path, argv, envp, fds, pgid);
+  default:          return spawn_fork(path, argv, envp, fds, pgid);
+  }
+}
+
+/*
+ * Wait for the child to finish and return its exit code, 128 plus the
+ * signal if one killed it, or -1. If usage is not NULL it is filled in
+ * with the resources the child used. If stopped is not NULL the wait
+ * also ends if the child stops, when *stopped is set and the code is
+ * 128 plus the signal that stopped it
+ */
+int
+execute_wait(pid_t pid, int *stopped, struct rusage *usage)
+{
+  int rc = -1;
+  int stat_loc;
+
+  pid = wait4(pid, &stat_loc, stopped ? WUNTRACED : 0, usage);
+  if (pid != -1 && WIFSTOPPED(stat_loc)) {
+    *stopped = 1;
+    rc = 128 + WSTOPSIG(stat_loc);
+  } else if (pid != -1 ) {
+    // Get the child exit code
+    rc = WIFSIGNALED(stat_loc) ? 128 + WTERMSIG(stat_loc) : WEXITSTATUS(stat_loc);
+  }
+  return rc;
+}
+
+/*
+ * Open the files a command redirects from and to. On return fds[] holds
+ * the descriptors to use for its standard input, output and error, or
+ * -1 where they are unchanged
+ */
+int
+execute_open(command_t *command, int fds[3])
+{
+  if (command->from) {
+    fds[STDIN_FILENO] = open(command->from, O_RDONLY | O_CLOEXEC);
+    if (fds[STDIN_FILENO] < 0) {
+      perror(command->from);
+      return -1;
+    }
+  }
+  if (command->to) {
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+    flags |= command->append ? O_APPEND : O_TRUNC;
+    fds[STDOUT_FILENO] = open(command->to, flags, 0666);
+    if (fds[STDOUT_FILENO] < 0) {
+      perror(command->to);
+      execute_close(fds);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Make a pipe whose ends are not inherited by anything we exec. A
+ * size asks the kernel for a bigger buffer than its default 64k, so
+ * a fast writer is stopped less often waiting for a slow reader
+ */
+int
+execute_pipe(int p[2], int size)
+{
+  if (pipe2(p, O_CLOEXEC) < 0) {
+    return -1;
+  }
+#ifdef F_SETPIPE_SZ
+  if (size > 0 && fcntl(p[1], F_SETPIPE_SZ, size) < 0) {
+    // Over /proc/sys/fs/pipe-max-size, so make do with the default
+    perror("pipe size");
+  }
+#endif
+  return 0;
+}
+
+void
+execute_close(int fds[3])
+{
+  int i;
+  for (i = 0; i < 3; i++) {
+    if (fds[i] > STDERR_FILENO) {
+      close(fds[i]);
+    }
+    fds[i] = -1;
+  }
+}
+
+/*
+ * Internal commands run in the shell itself, so redirect our own
+ * standard descriptors for the duration, saving the originals
+ */
+void
+execute_redirect(int fds[3], int saved[3])
+{
+  int i;
+
+  fflush(stdout);
+  for (i = 0; i < 3; i++) {
+    saved[i] = -1;
+    if (fds[i] >= 0 && fds[i] != i) {
+      saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 10);
+      dup2(fds[i], i);
+    }
+  }
+}
+
+void
+execute_restore(int saved[3])
+{
+  int i;
+
+  fflush(stdout);
+  for (i = 0; i < 3; i++) {
+    if (saved[i] >= 0) {
+      dup2(saved[i], i);
+      close(saved[i]);
+    }
+  }
+}
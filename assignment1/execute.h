@@ -0,0 +1,77 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * Process launcher interface
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+
+/*
+ * The ways in which a child process can be created. The method is
+ * selected by name at run time from the LSH_SPAWN shell variable
+ */
+typedef enum {
+  SPAWN_FORK,
+  SPAWN_VFORK,
+  SPAWN_POSIX,
+  SPAWN_ZYGOTE
+} spawn_t;
+
+void
+execute_init(int interactive);
+
+pid_t
+execute_group(void);
+
+void
+execute_foreground(pid_t pgid);
+
+spawn_t
+execute_method(const char *name);
+
+const char *
+execute_method_name(spawn_t method);
+
+char *
+path_lookup(const char *path, const char *binary);
+
+pid_t
+execute_spawn(spawn_t method, const char *path, char **argv, char **envp,
+              int fds[3], pid_t pgid);
+
+pid_t
+execute_fork(pid_t pgid, int fds[3]);
+
+int
+execute_wait(pid_t pid, int *stopped, struct rusage *usage);
+
+int
+execute_open(command_t *command, int fds[3]);
+
+int
+execute_pipe(int p[2], int size);
+
+void
+execute_close(int fds[3]);
+
+void
+execute_redirect(int fds[3], int saved[3]);
+
+void
+execute_restore(int saved[3]);
@@ -0,0 +1,432 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * Expand the $name, ${name} and $(( expression )) in a command's words
+ * just before it runs, so that each sees the effect of the last. The
+ * tokeniser has already replaced every '$' that should be expanded
+ * with CTL_EXPAND, so a quoted or escaped '$' is never touched here.
+ * Each word expands to exactly one word: there is no field splitting,
+ * and only ${name[@]} or "$@" standing alone as a word become several
+ *
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+
+#include "symtab.h"
+#include "arena.h"
+#include "tokenise.h"
+#include "parse.h"
+#include "arith.h"
+#include "expand.h"
+#include "func.h"
+#include "lsh.h"
+
+/*
+ * The expansion is built up at the end of the arena so it grows in
+ * place as each piece is added
+ */
+typedef struct {
+  arena_t *arena;
+  char *buf;
+  size_t len;
+  size_t size;
+} out_t;
+
+static void
+append(out_t *out, const char *s, size_t n)
+{
+  if (out->len + n + 1 > out->size) {
+    size_t size = (out->len + n + 1) * 2;
+    out->buf = arena_realloc(out->arena, out->buf, out->size, size);
+    out->size = size;
+  }
+  memcpy(&out->buf[out->len], s, n);
+  out->len += n;
+}
+
+static int
+name_char(int c, int first)
+{
+  return isalpha(c) || c == '_' || (!first && isdigit(c));
+}
+
+static symbol_t *
+lookup(const char *name, size_t len)
+{
+  char var[256];
+
+  if (len >= sizeof(var)) {
+    return NULL;
+  }
+  memcpy(var, name, len);
+  var[len] = '\0';
+  return symtab_lookup(symtab, var);
+}
+
+static const char *
+value(symbol_t *symbol)
+{
+  const char *v = symbol ? symtab_string(symbol) : NULL;
+  return v ? v : "";
+}
+
+/*
+ * Item i of an array, counting back from the end if it is negative. A
+ * plain variable is an array of one
+ */
+static const char *
+item(symbol_t *symbol, int64_t i)
+{
+  if (symbol && symbol->type == SYM_ARRAY) {
+    array_t *array = symbol->value;
+    if (i < 0) {
+      i += array->count;
+    }
+    return i >= 0 && i < array->count ? array->items[i] : "";
+  }
+  return i == 0 || i == -1 ? value(symbol) : "";
+}
+
+/*
+ * The subscript of ${name[...]}, which is an arithmetic expression
+ */
+static int
+subscript(const char *sub, size_t len, int64_t *i)
+{
+#ifdef LSH_ENABLE_ARITH
+  return arith_eval(sub, len, i);
+#else
+  char *end;
+  *i = strtoll(sub, &end, 10);
+  if (end != sub + len || len == 0) {
+    fprintf(stderr, "%.*s: bad array subscript\n", (int)len, sub);
+    return -1;
+  }
+  return 0;
+#endif
+}
+
+/*
+ * ${name}, ${name[i]}, ${name[@]} or ${name[*]}, and with a '#' after
+ * the '{' the length of any of them instead. ${name[@]} on its own as
+ * a word is spliced by expand_command() before we get here, so both
+ * join the items with a space
+ */
+static const char *
+braces(out_t *out, const char *p)
+{
+  const char *start = p, *name, *sub = NULL;
+  int length = p[1] == '#';
+  symbol_t *symbol;
+  const char *v;
+  size_t sublen = 0;
+  char buf[24];
+
+#ifdef LSH_ENABLE_FUNCS
+  if (isdigit((unsigned char)start[1])) {
+    // ${10} and on, the positional parameters past $9
+    int i = strtol(start + 1, (char **)&p, 10);
+    if (*p == '}') {
+      v = func_arg(i);
+      append(out, v, strlen(v));
+      return p + 1;
+    }
+  }
+#endif
+  for (name = p = start + 1 + length; name_char((unsigned char)*p, p == name); p++)
+    ;
+  if (p > name && *p == '[') {
+    sub = ++p;
+    p = strchr(p, ']');
+    sublen = p ? p - sub : 0;
+    p = p ? p + 1 : sub;
+  }
+  if (*p != '}' || p == name || (sub && sublen == 0)) {
+    const char *close = strchr(start, '}');
+    fprintf(stderr, "$%.*s: bad substitution\n",
+            close ? (int)(close - start + 1) : (int)strlen(start), start);
+    return NULL;
+  }
+  symbol = lookup(name, (sub ? sub - 1 : p) - name);
+  if (sub && sublen == 1 && (*sub == '@' || *sub == '*')) {
+    array_t *array = symbol && symbol->type == SYM_ARRAY ? symbol->value : NULL;
+    if (length) {
+      int n = array ? array->count : symbol != NULL;
+      append(out, buf, snprintf(buf, sizeof(buf), "%d", n));
+    } else if (array) {
+      int i;
+      for (i = 0; i < array->count; i++) {
+        if (i > 0) {
+          append(out, " ", 1);
+        }
+        append(out, array->items[i], strlen(array->items[i]));
+      }
+    } else {
+      v = value(symbol);
+      append(out, v, strlen(v));
+    }
+    return p + 1;
+  }
+  if (sub) {
+    int64_t i;
+    if (subscript(sub, sublen, &i) < 0) {
+      return NULL;
+    }
+    v = item(symbol, i);
+  } else {
+    v = value(symbol);
+  }
+  if (length) {
+    append(out, buf, snprintf(buf, sizeof(buf), "%zu", strlen(v)));
+  } else {
+    append(out, v, strlen(v));
+  }
+  return p + 1;
+}
+
+/*
+ * Expand the one thing at p, just after a CTL_EXPAND, onto out and
+ * return where the word carries on, or NULL if it is not valid
+ */
+static const char *
+expansion(out_t *out, const char *p)
+{
+  const char *start = p;
+
+#ifdef LSH_ENABLE_ARITH
+  if (p[0] == '(' && p[1] == '(') {
+    // $(( expression ))
+    int depth = 0;
+    for (; *p; p++) {
+      if (*p == '(') {
+        depth++;
+      } else if (*p == ')' && --depth == 1 && p[1] == ')') {
+        break;
+      }
+    }
+    if (!*p) {
+      fprintf(stderr, "$%s: missing '))'\n", start);
+      return NULL;
+    }
+    int64_t v;
+    char buf[24];
+    if (arith_eval(start + 2, p - start - 2, &v) < 0) {
+      return NULL;
+    }
+    append(out, buf, snprintf(buf, sizeof(buf), "%lld", (long long)v));
+    return p + 2;
+  }
+#endif
+  if (*p == '{') {
+    return braces(out, p);
+  }
+  if (*p == '?') {
+    // $? the exit code of the last line
+    const char *v = value(lookup(p, 1));
+    append(out, v, strlen(v));
+    return p + 1;
+  }
+#ifdef LSH_ENABLE_FUNCS
+  if (isdigit((unsigned char)*p)) {
+    // $0 to $9
+    const char *v = func_arg(*p - '0');
+    append(out, v, strlen(v));
+    return p + 1;
+  }
+  if (*p == '#') {
+    char buf[24];
+    append(out, buf, snprintf(buf, sizeof(buf), "%d", func_argc()));
+    return p + 1;
+  }
+  if (*p == '@' || *p == '*') {
+    // Both joined with a space, unless "$@" is a word on its own
+    char **argv = func_argv();
+    int i;
+    for (i = 0; argv[i]; i++) {
+      if (i > 0) {
+        append(out, " ", 1);
+      }
+      append(out, argv[i], strlen(argv[i]));
+    }
+    return p + 1;
+  }
+#endif
+  if (name_char((unsigned char)*p, 1)) {
+    // $name
+    while (name_char((unsigned char)*p, 0)) {
+      p++;
+    }
+    const char *v = value(lookup(start, p - start));
+    append(out, v, strlen(v));
+    return p;
+  }
+  // Nothing we know how to expand, so it was just a '$'
+  append(out, "$", 1);
+  return p;
+}
+
+/*
+ * Return word with everything in it expanded, either word itself if
+ * there was nothing to do or a copy in the arena. Returns NULL if an
+ * expansion failed, having said why
+ */
+char *
+expand_word(arena_t *arena, char *word)
+{
+  out_t out = { arena, NULL, 0, 0 };
+  const char *p = word, *ctl;
+
+  if (!strchr(word, CTL_EXPAND)) {
+    return word;
+  }
+  while ((ctl = strchr(p, CTL_EXPAND)) != NULL) {
+    append(&out, p, ctl - p);
+    if ((p = expansion(&out, ctl + 1)) == NULL) {
+      return NULL;
+    }
+  }
+  append(&out, p, strlen(p));
+  out.buf[out.len] = '\0';
+  return out.buf;
+}
+
+/*
+ * If word is nothing but ${name[@]} and name is an array, the array
+ */
+static array_t *
+whole(const char *word)
+{
+  const char *name = word + 2, *p;
+  symbol_t *symbol;
+
+  if (word[0] != CTL_EXPAND || word[1] != '{') {
+    return NULL;
+  }
+  for (p = name; name_char((unsigned char)*p, p == name); p++)
+    ;
+  if (p == name || strcmp(p, "[@]}") != 0) {
+    return NULL;
+  }
+  symbol = lookup(name, p - name);
+  return symbol && symbol->type == SYM_ARRAY ? symbol->value : NULL;
+}
+
+/*
+ * Make room for n words in place of word i of the count words in
+ * *wordsp and return where they are to go
+ */
+static char **
+widen(arena_t *arena, char ***wordsp, int *countp, int i, int n)
+{
+  char **words = arena_alloc(arena, (*countp + n) * sizeof(char *));
+
+  memcpy(words, *wordsp, i * sizeof(char *));
+  // The words after it, and the NULL
+  memcpy(&words[i + n], &(*wordsp)[i + 1], (*countp - i) * sizeof(char *));
+  *wordsp = words;
+  *countp += n - 1;
+  return &words[i];
+}
+
+/*
+ * Put the items of an array in place of word i of the count words in
+ * *wordsp. The items are not re-tokenised or expanded, and their text
+ * is copied in one go from the array's pool so that nothing a command
+ * does to the array can change its own arguments
+ */
+static void
+splice(arena_t *arena, char ***wordsp, int *countp, int i, array_t *array)
+{
+  char *pool = arena_alloc(arena, array->used + 1);
+  char **words = widen(arena, wordsp, countp, i, array->count);
+  int j;
+
+  if (array->used) {
+    memcpy(pool, array->pool, array->used);
+  }
+  for (j = 0; j < array->count; j++) {
+    words[j] = pool + (array->items[j] - array->pool);
+  }
+}
+
+/*
+ * Expand count words in place, splicing in any arrays
+ */
+static int
+expand_words(arena_t *arena, char ***wordsp, int *countp)
+{
+  int i;
+
+  for (i = 0; i < *countp; i++) {
+    array_t *array = whole((*wordsp)[i]);
+#ifdef LSH_ENABLE_FUNCS
+    const char *w = (*wordsp)[i];
+    if (w[0] == CTL_EXPAND && w[1] == '@' && w[2] == '\0') {
+      // The positional parameters, which last as long as the call
+      int n = func_argc();
+      memcpy(widen(arena, wordsp, countp, i, n), func_argv(), n * sizeof(char *));
+      i += n - 1;
+      continue;
+    }
+#endif
+    if (array) {
+      splice(arena, wordsp, countp, i, array);
+      i += array->count - 1;
+    } else if (((*wordsp)[i] = expand_word(arena, (*wordsp)[i])) == NULL) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Expand all of a command's words in place. Returns -1 if any failed
+ */
+int
+expand_command(arena_t *arena, command_t *command)
+{
+  int i;
+
+#define EXPAND(w) do {                                    \
+    if ((w) && ((w) = expand_word(arena, (w))) == NULL) { \
+      return -1;                                          \
+    }                                                     \
+  } while (0)
+
+  for (i = 0; i < command->nassigns; i++) {
+    assign_t *assign = &command->assigns[i];
+    if (assign->items) {
+      if (expand_words(arena, &assign->items, &assign->nitems) < 0) {
+        return -1;
+      }
+    } else {
+      EXPAND(assign->value);
+    }
+  }
+  if (expand_words(arena, &command->argv, &command->argc) < 0) {
+    return -1;
+  }
+  EXPAND(command->from);
+  EXPAND(command->to);
+#undef EXPAND
+  return 0;
+}
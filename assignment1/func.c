@@ -0,0 +1,428 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * Shell functions, compound commands and positional parameters (the
+ * 'return', 'break' and 'continue' internal commands)
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "symtab.h"
+#include "parse.h"
+#include "func.h"
+#include "lsh.h"
+
+#ifdef LSH_ENABLE_FUNCS
+
+/*
+ * A function is defined by
+ *
+ *   <name>() {
+ *     <line>
+ *     ...
+ *   }
+ *
+ * Each line of the body is tokenised and parsed as it is read, like
+ * any other, and the pipeline is copied, words and all, into the
+ * function's own arena instead of being run. Calling the function runs
+ * those pipelines from then on, so nothing is parsed again. Functions
+ * are SYM_FUNC symbols, in the one table with the variables, so a
+ * function and a variable can't share a name.
+ *
+ * A compound command
+ *
+ *   if <pipeline>
+ *   then
+ *     <line> ...
+ *   [elif <pipeline>
+ *   then
+ *     <line> ...] ...
+ *   [else
+ *     <line> ...]
+ *   fi
+ *
+ *   while <pipeline>             for <name> [in <word> ...]
+ *   do                           do
+ *     <line> ...                   <line> ...
+ *   done                         done
+ *
+ * (with a then or do also allowed at the end of the line before, after
+ * a ;, and a for with no in going over "$@") is read in just the same way, into a body with no name that is
+ * run as soon as its last line has been read and then thrown away. The
+ * lines of one nested in it, or in a function, are kept in line with
+ * the rest, and the line that opens each loop or clause is given the
+ * index of the line that ends it so that running it never has to look
+ * for that. Which compound commands are open while reading is kept on
+ * a stack, and a keyword that does not fit throws away everything read
+ * so far.
+ *
+ * The positional parameters $1, $2, ... are a stack of frames, one for
+ * each call in progress, with the shell's own arguments at the bottom.
+ * A frame is only the argc and argv the function was called with, which
+ * outlive the call, so pushing and popping one copies nothing
+ */
+#define MAX_DEPTH 1000          // Calls in progress at once, like FUNCNEST
+
+typedef struct {
+  int argc;
+  char **argv;
+} frame_t;
+
+typedef enum {
+  S_COND,                       // Waiting for its then or do
+  S_BODY,
+  S_ELSE                        // After the else of an if
+} state_t;
+
+typedef struct {
+  keyword_t keyword;            // K_FUNCTION, K_IF, K_WHILE or K_FOR
+  state_t state;
+  int at;                       // The line whose jump is still to come, or -1
+} open_t;
+
+static frame_t *frames;
+static int depth;
+static int room;
+
+static func_t *defining;        // The function or compound command being read
+static open_t *opens;
+static int nopen;
+static int opens_room;
+
+// Set by 'return' until the function it returns from sees it
+int func_returning;
+
+// Set by 'break' and 'continue' to how many loops they are for
+int func_breaking;
+int func_continuing;
+
+// Loops running in the current function, or outside any
+int func_loops;
+
+void
+func_hold(func_t *func)
+{
+  func->refs++;
+}
+
+void
+func_release(func_t *func)
+{
+  if (--func->refs == 0) {
+    free(func->body);
+    free(func->jump);
+    arena_free(&func->arena);
+    free(func);
+  }
+}
+
+static void
+dispose(void *value)
+{
+  func_release(value);
+}
+
+void
+func_init(void)
+{
+  symtab_dispose(dispose);
+}
+
+static void
+push(keyword_t keyword, state_t state, int at)
+{
+  if (nopen == opens_room) {
+    opens_room = opens_room ? opens_room * 2 : 8;
+    opens = realloc(opens, opens_room * sizeof(open_t));
+  }
+  opens[nopen].keyword = keyword;
+  opens[nopen].state = state;
+  opens[nopen].at = at;
+  nopen++;
+}
+
+/*
+ * Keep track of the compound commands a line opens and closes, as the
+ * next line of func. Returns -1 if it can't go there
+ */
+static int
+step(func_t *func, pipeline_t *pipeline)
+{
+  keyword_t k = pipeline->keyword;
+  open_t *top = nopen > 0 ? &opens[nopen - 1] : NULL;
+  int n = func->lines;
+
+  if (top && top->state == S_COND && k != K_THEN && k != K_DO) {
+    return -1;
+  }
+  switch (k) {
+  case K_NONE:
+    return 0;
+  case K_FUNCTION:
+  case K_IF:
+  case K_WHILE:
+  case K_FOR:
+    push(k, k == K_FUNCTION || pipeline->ready ? S_BODY : S_COND, n);
+    return 0;
+  case K_THEN:
+  case K_DO:
+    if (!top || top->state != S_COND || (k == K_THEN) != (top->keyword == K_IF)) {
+      return -1;
+    }
+    top->state = S_BODY;
+    return 0;
+  case K_ELIF:
+  case K_ELSE:
+    if (!top || top->keyword != K_IF || top->state != S_BODY) {
+      return -1;
+    }
+    func->jump[top->at] = n;
+    top->at = n;
+    top->state = k == K_ELSE ? S_ELSE : pipeline->ready ? S_BODY : S_COND;
+    return 0;
+  case K_FI:
+    if (!top || top->keyword != K_IF) {
+      return -1;
+    }
+    break;
+  case K_DONE:
+    if (!top || (top->keyword != K_WHILE && top->keyword != K_FOR)) {
+      return -1;
+    }
+    break;
+  case K_CLOSE:
+    if (!top || top->keyword != K_FUNCTION) {
+      return -1;
+    }
+    break;
+  }
+  if (top->at >= 0) {
+    func->jump[top->at] = n;
+  }
+  nopen--;
+  return 0;
+}
+
+static void
+append(func_t *func, pipeline_t *pipeline)
+{
+  if (func->lines == func->size) {
+    func->size = func->size ? func->size * 2 : 8;
+    func->body = realloc(func->body, func->size * sizeof(pipeline_t *));
+    func->jump = realloc(func->jump, func->size * sizeof(int));
+  }
+  func->jump[func->lines] = func->lines;
+  func->body[func->lines++] = parse_copy(&func->arena, pipeline, 1);
+}
+
+static void
+abandon(void)
+{
+  func_release(defining);
+  defining = NULL;
+  nopen = 0;
+}
+
+/*
+ * Called with every line before it is run. Returns 1 if the line was
+ * taken as part of a function definition or a compound command and so
+ * is not to be run by itself. When it was the last line of a compound
+ * command, that is left in *ready for the caller to run and release
+ */
+int
+func_collect(pipeline_t *pipeline, func_t **ready)
+{
+  keyword_t k = pipeline->keyword;
+  func_t *func = defining;
+
+  *ready = NULL;
+  if (!func) {
+    if (k == K_NONE) {
+      return 0;
+    }
+    func = defining = calloc(1, sizeof(func_t));
+    func->refs = 1;
+    if (k == K_FUNCTION) {
+      const char *name = pipeline->commands->argv[0];
+      func->name = arena_strndup(&func->arena, name, strlen(name));
+      push(K_FUNCTION, S_BODY, -1);
+      return 1;
+    }
+  }
+
+  if (step(func, pipeline) < 0) {
+    fprintf(stderr, "syntax error near unexpected token '%s'\n",
+            k != K_NONE ? parse_keyword(k) :
+            pipeline->commands->argc ? pipeline->commands->argv[0] : "newline");
+    abandon();
+    return 1;
+  }
+  if (nopen == 0 && func->name) {
+    // Its own } is not kept
+    defining = NULL;
+    symtab = symtab_set(symtab, func->name, SYM_FUNC, func);
+    return 1;
+  }
+  append(func, pipeline);
+  if (nopen == 0) {
+    defining = NULL;
+    *ready = func;
+  }
+  return 1;
+}
+
+/*
+ * Whether a function or compound command is still being read. Once the
+ * input has ended it never will be, so with finish set it is thrown
+ * away and said so
+ */
+int
+func_pending(int finish)
+{
+  if (defining && finish) {
+    if (defining->name) {
+      fprintf(stderr, "syntax error: unexpected end of file in function '%s'\n",
+              defining->name);
+    } else {
+      fprintf(stderr, "syntax error: unexpected end of file\n");
+    }
+    abandon();
+    return 1;
+  }
+  return defining != NULL;
+}
+
+/*
+ * Make argv[1] to argv[argc - 1] the positional parameters until the
+ * matching func_pop(). The first push is the shell's own arguments
+ */
+int
+func_push(int argc, char **argv)
+{
+  if (depth > MAX_DEPTH) {
+    fprintf(stderr, "%s: maximum function nesting level exceeded (%d)\n",
+            argv[0], MAX_DEPTH);
+    return -1;
+  }
+  if (depth == room) {
+    room = room ? room * 2 : 16;
+    frames = realloc(frames, room * sizeof(frame_t));
+  }
+  frames[depth].argc = argc;
+  frames[depth].argv = argv;
+  depth++;
+  return 0;
+}
+
+void
+func_pop(void)
+{
+  depth--;
+}
+
+/*
+ * $i, which is empty if there are fewer parameters. $0 is always the
+ * shell's, not the function's
+ */
+const char *
+func_arg(int i)
+{
+  frame_t *frame = i == 0 ? &frames[0] : &frames[depth - 1];
+
+  return depth > 0 && i < frame->argc ? frame->argv[i] : "";
+}
+
+// $#
+int
+func_argc(void)
+{
+  return depth > 0 ? frames[depth - 1].argc - 1 : 0;
+}
+
+// $@, NULL terminated
+char **
+func_argv(void)
+{
+  static char *none[] = { NULL };
+
+  return depth > 0 ? frames[depth - 1].argv + 1 : none;
+}
+
+/*
+ * return [n]
+ *
+ * Leave the function being run with exit code n, or that of the last
+ * command if there is none
+ */
+int
+lsh_return(int argc, char **argv)
+{
+  if (depth < 2) {
+    fprintf(stderr, "%s: can only return from a function\n", argv[0]);
+    return 1;
+  }
+  func_returning = 1;
+  return argc > 1 ? atoi(argv[1]) & 0xff : atoi(symtab_fetch(symtab, "?", "0"));
+}
+
+/*
+ * Leave n loops, the innermost first, by setting *count
+ */
+static int
+leave(int argc, char **argv, int *count)
+{
+  int n = argc > 1 ? atoi(argv[1]) : 1;
+
+  if (func_loops == 0) {
+    fprintf(stderr, "%s: only meaningful in a loop\n", argv[0]);
+    return 0;
+  }
+  if (n < 1) {
+    fprintf(stderr, "%s: %s: loop count out of range\n", argv[0], argv[1]);
+    return 1;
+  }
+  *count = n < func_loops ? n : func_loops;
+  return 0;
+}
+
+/*
+ * break [n]
+ *
+ * Leave the loop being run, or the n innermost loops being run
+ */
+int
+lsh_break(int argc, char **argv)
+{
+  return leave(argc, argv, &func_breaking);
+}
+
+/*
+ * continue [n]
+ *
+ * Start the next time round the loop being run, or the nth loop out
+ * having left the ones inside it
+ */
+int
+lsh_continue(int argc, char **argv)
+{
+  return leave(argc, argv, &func_continuing);
+}
+#endif /* LSH_ENABLE_FUNCS */
@@ -0,0 +1,80 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * Shell functions interface
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A function's body, or a compound command, parsed once when it is
+ * read. A line that opens a loop or a clause of an if has in jump the
+ * line that ends it: the done, or the next elif, else or fi. Any other
+ * line ends itself
+ */
+typedef struct func {
+  arena_t arena;            // Everything below is allocated here
+  char *name;               // NULL for a compound command
+  pipeline_t **body;
+  int *jump;
+  int lines;
+  int size;                 // Allocated lines
+  int refs;                 // The symbol table's and one for each call
+} func_t;
+
+extern int func_returning;
+extern int func_breaking;
+extern int func_continuing;
+extern int func_loops;
+
+void
+func_init(void);
+
+int
+func_collect(pipeline_t *pipeline, func_t **ready);
+
+int
+func_pending(int finish);
+
+void
+func_hold(func_t *func);
+
+void
+func_release(func_t *func);
+
+int
+func_push(int argc, char **argv);
+
+void
+func_pop(void);
+
+const char *
+func_arg(int i);
+
+int
+func_argc(void);
+
+char **
+func_argv(void);
+
+int
+lsh_return(int argc, char **argv);
+
+int
+lsh_break(int argc, char **argv);
+
+int
+lsh_continue(int argc, char **argv);
@@ -0,0 +1,200 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * Command resolution cache (the 'hash' internal command)
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "symtab.h"
+#include "internal.h"
+#include "arena.h"
+#include "parse.h"
+#include "execute.h"
+#include "hash.h"
+#include "phase.h"
+#include "lsh.h"
+
+/*
+ * Every command name we have resolved so far is remembered here so that
+ * running it again costs neither a symbol table walk nor a stat() of
+ * each PATH directory. Chained on a small fixed number of buckets
+ */
+#define BUCKETS 64
+
+static resolved_t *buckets[BUCKETS];
+
+static unsigned
+hash(const char *name)
+{
+  // FNV-1a
+  unsigned h = 2166136261u;
+  while (*name) {
+    h = (h ^ (unsigned char)*name++) * 16777619u;
+  }
+  return h % BUCKETS;
+}
+
+static void
+release(resolved_t *r)
+{
+  free(r->name);
+  free(r->path);
+  free(r);
+}
+
+/*
+ * Find what name refers to, from the cache if we can. Names containing
+ * a '/' are never looked up on the PATH so are not cached either.
+ * Returns NULL if the name could not be resolved
+ */
+resolved_t *
+hash_resolve(const char *name)
+{
+  unsigned h = hash(name);
+  resolved_t *r;
+
+  for (r = buckets[h]; r; r = r->next) {
+    if (strcmp(r->name, name) == 0) {
+      r->hits++;
+      return r;
+    }
+  }
+
+  symbol_t *symbol = symtab_lookup(symtab, (char *)name);
+  if (symbol && symbol->type == SYM_INTERNAL) {
+    r = calloc(1, sizeof(resolved_t));
+    r->type = R_INTERNAL;
+    r->internal = (internal_t)symbol->value;
+  } else if (symbol && symbol->type == SYM_FUNC) {
+    // Forgotten when it is defined again, so it is never out of date
+    r = calloc(1, sizeof(resolved_t));
+    r->type = R_FUNCTION;
+    r->func = symbol->value;
+  }
+#ifdef LSH_ENABLE_EXTERNAL
+  else if (index(name, '/') == NULL) {
+    PHASE(P_SEARCH);
+    char *path = path_lookup(symtab_fetch(symtab, "PATH", PATH), name);
+    PHASE(P_RESOLVE);
+    if (path) {
+      r = calloc(1, sizeof(resolved_t));
+      r->type = R_EXTERNAL;
+      r->path = path;
+    }
+  }
+#endif
+  if (r) {
+    r->name = strdup(name);
+    r->hits = 1;
+    r->next = buckets[h];
+    buckets[h] = r;
+  }
+  return r;
+}
+
+void
+hash_forget(const char *name)
+{
+  resolved_t **rp;
+
+  for (rp = &buckets[hash(name)]; *rp; rp = &(*rp)->next) {
+    if (strcmp((*rp)->name, name) == 0) {
+      resolved_t *r = *rp;
+      *rp = r->next;
+      release(r);
+      break;
+    }
+  }
+}
+
+void
+hash_reset(void)
+{
+  int i;
+  for (i = 0; i < BUCKETS; i++) {
+    while (buckets[i]) {
+      resolved_t *r = buckets[i];
+      buckets[i] = r->next;
+      release(r);
+    }
+  }
+}
+
+/*
+ * Symbol table hook. A new PATH invalidates every external command
+ * while any other symbol can only shadow the command of the same name
+ */
+void
+hash_changed(const char *name)
+{
+  if (strcmp(name, "PATH") == 0) {
+    hash_reset();
+  } else {
+    hash_forget(name);
+  }
+}
+
+/*
+ * hash [-r] [name ...]
+ *
+ * With no arguments list the cached commands. -r empties the cache and
+ * any names given are resolved and added to it
+ */
+int
+lsh_hash(int argc, char **argv)
+{
+  int status = 0;
+  int i = 1;
+
+  if (argc > 1 && strcmp(argv[1], "-r") == 0) {
+    hash_reset();
+    i++;
+  }
+  if (argc == 1) {
+    int empty = 1;
+    for (i = 0; i < BUCKETS; i++) {
+      resolved_t *r;
+      for (r = buckets[i]; r; r = r->next) {
+        if (empty) {
+          printf("hits\tcommand\n");
+          empty = 0;
+        }
+        printf("%4d\t%s\n", r->hits,
+               r->type == R_EXTERNAL ? r->path : r->name);
+      }
+    }
+    if (empty) {
+      printf("%s: hash table empty\n", argv[0]);
+    }
+  }
+  for (; i < argc; i++) {
+    resolved_t *r = hash_resolve(argv[i]);
+    if (r) {
+      // Resolving it here is not a use of it
+      r->hits--;
+    } else {
+      fprintf(stderr, "%s: %s: not found\n", argv[0], argv[i]);
+      status = 1;
+    }
+  }
+  return status;
+}
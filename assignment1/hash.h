@@ -0,0 +1,55 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * Command resolution cache interface
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+typedef enum {
+  R_INTERNAL,
+  R_EXTERNAL,
+  R_FUNCTION
+} rtype_t;
+
+/*
+ * What a command name resolved to: an internal command, a shell
+ * function or the absolute path of a binary found on the PATH
+ */
+typedef struct resolved {
+  char *name;
+  rtype_t type;
+  internal_t internal;
+  struct func *func;
+  char *path;
+  int hits;
+  struct resolved *next;
+} resolved_t;
+
+resolved_t *
+hash_resolve(const char *name);
+
+void
+hash_forget(const char *name);
+
+void
+hash_reset(void);
+
+void
+hash_changed(const char *name);
+
+int
+lsh_hash(int argc, char **argv);
@@ -23,6 +23,15 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#ifdef LSH_ENABLE_BUILTINS
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#endif
 
 void
 lsh_not_impl(const char *cmd)
@@ -45,3 +54,860 @@ int lsh_cd(int argc, char **argv)
 }
 #endif
  
+
+#ifdef LSH_ENABLE_BUILTINS
+/*
+ * Commands that scripts run so often that a fork and exec for each is
+ * most of their cost. Each behaves, and exits, as the coreutils program
+ * of the same name does. Anything naming a path (/bin/echo) still runs
+ * the real thing
+ */
+
+int lsh_true(int argc, char **argv)
+{
+  return 0;
+}
+
+int lsh_false(int argc, char **argv)
+{
+  return 1;
+}
+
+// How unescape() takes octal
+typedef enum {
+  OCTAL_ZERO,                   // \0NNN, for echo
+  OCTAL_PLAIN,                  // \NNN, in a printf format
+  OCTAL_EITHER                  // Both, for %b
+} octal_t;
+
+/*
+ * Write the character for the escape sequence at *sp, which follows a
+ * '\\', and advance *sp past it. Returns 0 at a \c, which ends all
+ * output
+ */
+static int
+unescape(const char **sp, octal_t octal)
+{
+  const char *s = *sp;
+  int c = *s++, i;
+
+  switch (c) {
+  case 'a':  c = '\a';   break;
+  case 'b':  c = '\b';   break;
+  case 'c':  return 0;
+  case 'e':  c = 033;    break;
+  case 'f':  c = '\f';   break;
+  case 'n':  c = '\n';   break;
+  case 'r':  c = '\r';   break;
+  case 't':  c = '\t';   break;
+  case 'v':  c = '\v';   break;
+  case 'x':
+    if (!isxdigit((unsigned char)*s)) {
+      // Not an escape after all
+      putchar('\\');
+      break;
+    }
+    for (c = 0, i = 0; i < 2 && isxdigit((unsigned char)*s); i++, s++) {
+      c = c * 16 + (isdigit((unsigned char)*s) ? *s - '0' : tolower(*s) - 'a' + 10);
+    }
+    break;
+  case '0': case '1': case '2': case '3':
+  case '4': case '5': case '6': case '7':
+    if (octal == OCTAL_ZERO && c != '0') {
+      putchar('\\');
+      break;
+    }
+    if (octal != OCTAL_PLAIN && c == '0') {
+      c = *s;
+      if (c < '0' || c > '7') {
+        c = 0;
+        break;
+      }
+      s++;
+    }
+    for (c -= '0', i = 1; i < 3 && *s >= '0' && *s <= '7'; i++, s++) {
+      c = c * 8 + *s - '0';
+    }
+    break;
+  case '\\':
+    break;
+  case '\0':
+    // A '\\' at the very end
+    s--;
+    c = '\\';
+    break;
+  default:
+    putchar('\\');
+    break;
+  }
+  putchar(c);
+  *sp = s;
+  return 1;
+}
+
+/*
+ * echo [-neE] [string ...]
+ */
+int lsh_echo(int argc, char **argv)
+{
+  int newline = 1, escapes = 0;
+  int i;
+
+  for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+    // Only a word made up entirely of option letters is options
+    if (strspn(&argv[i][1], "neE") != strlen(&argv[i][1])) {
+      break;
+    }
+    const char *o;
+    for (o = &argv[i][1]; *o; o++) {
+      switch (*o) {
+      case 'n': newline = 0; break;
+      case 'e': escapes = 1; break;
+      case 'E': escapes = 0; break;
+      }
+    }
+  }
+  for (; i < argc; i++) {
+    const char *s = argv[i];
+    if (!escapes) {
+      fputs(s, stdout);
+    } else {
+      while (*s) {
+        if (*s == '\\') {
+          s++;
+          if (!unescape(&s, OCTAL_ZERO)) {
+            return 0;
+          }
+        } else {
+          putchar(*s++);
+        }
+      }
+    }
+    if (i + 1 < argc) {
+      putchar(' ');
+    }
+  }
+  if (newline) {
+    putchar('\n');
+  }
+  return 0;
+}
+
+/*
+ * pwd [-LP]
+ *
+ * Physical (-P) by default, as the coreutils pwd is. -L prints $PWD
+ * instead if that is an absolute name for where we are
+ */
+int lsh_pwd(int argc, char **argv)
+{
+  char buf[PATH_MAX];
+  int logical = 0, i;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-L") == 0) {
+      logical = 1;
+    } else if (strcmp(argv[i], "-P") == 0) {
+      logical = 0;
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "%s: invalid option -- '%s'\n", argv[0], &argv[i][1]);
+      return 1;
+    } else {
+      fprintf(stderr, "%s: ignoring non-option arguments\n", argv[0]);
+      break;
+    }
+  }
+  if (logical) {
+    const char *pwd = getenv("PWD");
+    struct stat a, b;
+    if (pwd && pwd[0] == '/' && !strstr(pwd, "/.") &&
+        stat(pwd, &a) == 0 && stat(".", &b) == 0 &&
+        a.st_dev == b.st_dev && a.st_ino == b.st_ino) {
+      puts(pwd);
+      return 0;
+    }
+  }
+  if (!getcwd(buf, sizeof(buf))) {
+    perror(argv[0]);
+    return 1;
+  }
+  puts(buf);
+  return 0;
+}
+
+/*
+ * basename NAME [SUFFIX]
+ * basename -a [-s SUFFIX] [-z] NAME ...
+ */
+static void
+base(const char *name, const char *suffix, int eol)
+{
+  size_t len = strlen(name), start, slen;
+
+  // Trailing slashes are not part of the name, unless it is all slashes
+  while (len > 1 && name[len - 1] == '/') {
+    len--;
+  }
+  for (start = len; start > 0 && name[start - 1] != '/'; start--)
+    ;
+  if (start == len && len > 0) {
+    // Nothing but slashes
+    start = len - 1;
+  }
+  if (suffix && (slen = strlen(suffix)) < len - start &&
+      memcmp(&name[len - slen], suffix, slen) == 0) {
+    len -= slen;
+  }
+  fwrite(&name[start], 1, len - start, stdout);
+  putchar(eol);
+}
+
+int lsh_basename(int argc, char **argv)
+{
+  const char *suffix = NULL;
+  int multiple = 0, eol = '\n';
+  int i;
+
+  for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+    if (strcmp(argv[i], "--") == 0) {
+      i++;
+      break;
+    } else if (strcmp(argv[i], "-a") == 0) {
+      multiple = 1;
+    } else if (strcmp(argv[i], "-z") == 0) {
+      eol = '\0';
+    } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      suffix = argv[++i];
+      multiple = 1;
+    } else if (strncmp(argv[i], "-s", 2) == 0 && argv[i][2]) {
+      suffix = &argv[i][2];
+      multiple = 1;
+    } else {
+      fprintf(stderr, "%s: invalid option -- '%s'\n", argv[0], &argv[i][1]);
+      return 1;
+    }
+  }
+  if (i == argc) {
+    fprintf(stderr, "%s: missing operand\n", argv[0]);
+    return 1;
+  }
+  if (!multiple) {
+    if (argc - i > 2) {
+      fprintf(stderr, "%s: extra operand '%s'\n", argv[0], argv[i + 2]);
+      return 1;
+    }
+    base(argv[i], argc - i == 2 ? argv[i + 1] : NULL, eol);
+    return 0;
+  }
+  for (; i < argc; i++) {
+    base(argv[i], suffix, eol);
+  }
+  return 0;
+}
+
+/*
+ * dirname [-z] NAME ...
+ */
+static void
+dir(const char *name, int eol)
+{
+  const char *p, *last;
+  size_t len;
+  int slash = 0;
+
+  // Start of the last component, ignoring any slashes after it
+  for (p = name; *p == '/'; p++)
+    ;
+  for (last = p; *p; p++) {
+    if (*p == '/') {
+      slash = 1;
+    } else if (slash) {
+      last = p;
+      slash = 0;
+    }
+  }
+  for (len = last - name; len > 0 && name[len - 1] == '/'; len--)
+    ;
+  if (len == 0) {
+    fputs(name[0] == '/' ? "/" : ".", stdout);
+  } else {
+    fwrite(name, 1, len, stdout);
+  }
+  putchar(eol);
+}
+
+int lsh_dirname(int argc, char **argv)
+{
+  int eol = '\n';
+  int i;
+
+  for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+    if (strcmp(argv[i], "--") == 0) {
+      i++;
+      break;
+    } else if (strcmp(argv[i], "-z") == 0) {
+      eol = '\0';
+    } else {
+      fprintf(stderr, "%s: invalid option -- '%s'\n", argv[0], &argv[i][1]);
+      return 1;
+    }
+  }
+  if (i == argc) {
+    fprintf(stderr, "%s: missing operand\n", argv[0]);
+    return 1;
+  }
+  for (; i < argc; i++) {
+    dir(argv[i], eol);
+  }
+  return 0;
+}
+
+/*
+ * printf FORMAT [ARGUMENT ...]
+ */
+static int printf_status;
+
+static intmax_t
+signed_arg(const char *name, const char *arg)
+{
+  char *end;
+  intmax_t v;
+
+  if (arg[0] == '\'' || arg[0] == '"') {
+    return (unsigned char)arg[1];
+  }
+  errno = 0;
+  v = strtoimax(arg, &end, 0);
+  if (*arg == '\0' ) {
+    return 0;
+  }
+  if (end == arg || *end || errno) {
+    fprintf(stderr, "%s: '%s': %s\n", name, arg,
+            errno == ERANGE ? strerror(errno) :
+            end == arg ? "expected a numeric value" :
+            "value not completely converted");
+    printf_status = 1;
+  }
+  return v;
+}
+
+static uintmax_t
+unsigned_arg(const char *name, const char *arg)
+{
+  char *end;
+  uintmax_t v;
+
+  if (arg[0] == '\'' || arg[0] == '"') {
+    return (unsigned char)arg[1];
+  }
+  if (*arg == '\0') {
+    return 0;
+  }
+  errno = 0;
+  if (*arg == '-') {
+    v = strtoimax(arg, &end, 0);
+  } else {
+    v = strtoumax(arg, &end, 0);
+  }
+  if (end == arg || *end || errno) {
+    fprintf(stderr, "%s: '%s': %s\n", name, arg,
+            errno == ERANGE ? strerror(errno) :
+            end == arg ? "expected a numeric value" :
+            "value not completely converted");
+    printf_status = 1;
+  }
+  return v;
+}
+
+static long double
+float_arg(const char *name, const char *arg)
+{
+  char *end;
+  long double v;
+
+  if (arg[0] == '\'' || arg[0] == '"') {
+    return (unsigned char)arg[1];
+  }
+  if (*arg == '\0') {
+    return 0;
+  }
+  errno = 0;
+  v = strtold(arg, &end);
+  if (end == arg || *end || errno) {
+    fprintf(stderr, "%s: '%s': %s\n", name, arg,
+            end == arg ? "expected a numeric value" :
+            "value not completely converted");
+    printf_status = 1;
+  }
+  return v;
+}
+
+/*
+ * Print s so that the shell would read it back as the same word
+ */
+static void
+quote(const char *s)
+{
+  const char *safe = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
+                     "0123456789_./:+,@%-~#";
+
+  if (*s && *s != '~' && *s != '#' && strspn(s, safe) == strlen(s)) {
+    fputs(s, stdout);
+  } else if (strchr(s, '\'') && !strpbrk(s, "$`\"\\!")) {
+    printf("\"%s\"", s);
+  } else {
+    putchar('\'');
+    for (; *s; s++) {
+      if (*s == '\'') {
+        fputs("'\\''", stdout);
+      } else {
+        putchar(*s);
+      }
+    }
+    putchar('\'');
+  }
+}
+
+int lsh_printf(int argc, char **argv)
+{
+  const char *format, *f;
+  char **args, **end = argv + argc;
+  int at = 1;
+
+  // A -- before the format is only there to end the options
+  if (argc > 1 && strcmp(argv[1], "--") == 0) {
+    at++;
+  }
+  if (argc <= at) {
+    fprintf(stderr, "%s: missing operand\n", argv[0]);
+    return 1;
+  }
+  printf_status = 0;
+  format = argv[at];
+  args = &argv[at + 1];
+
+  /*
+   * The format is used again as many times as it takes to use up the
+   * arguments, though always at least once
+   */
+#define NEXT()  (args < end ? *args++ : "")
+  do {
+    char **first = args;
+
+    for (f = format; *f; f++) {
+      char spec[64];
+      size_t n = 0;
+
+      if (*f == '\\') {
+        f++;
+        if (!unescape(&f, OCTAL_PLAIN)) {
+          return printf_status;
+        }
+        f--;
+        continue;
+      }
+      if (*f != '%') {
+        putchar(*f);
+        continue;
+      }
+      if (f[1] == '%') {
+        putchar('%');
+        f++;
+        continue;
+      }
+
+      // %[flags][width][.precision]conversion
+      spec[n++] = *f++;
+      while (*f && strchr("-+ #0'", *f) && n < 8) {
+        spec[n++] = *f++;
+      }
+      if (*f == '*') {
+        n += snprintf(&spec[n], 24, "%d", (int)signed_arg(argv[0], NEXT()));
+        f++;
+      } else {
+        while (isdigit((unsigned char)*f) && n < 24) {
+          spec[n++] = *f++;
+        }
+      }
+      if (*f == '.') {
+        spec[n++] = *f++;
+        if (*f == '*') {
+          n += snprintf(&spec[n], 24, "%d", (int)signed_arg(argv[0], NEXT()));
+          f++;
+        } else {
+          while (isdigit((unsigned char)*f) && n < 48) {
+            spec[n++] = *f++;
+          }
+        }
+      }
+
+      switch (*f) {
+      case 'd': case 'i':
+        strcpy(&spec[n], "jd");
+        printf(spec, signed_arg(argv[0], NEXT()));
+        break;
+      case 'o': case 'u': case 'x': case 'X':
+        spec[n++] = 'j';
+        spec[n++] = *f;
+        spec[n] = '\0';
+        printf(spec, unsigned_arg(argv[0], NEXT()));
+        break;
+      case 'f': case 'F': case 'e': case 'E':
+      case 'g': case 'G': case 'a': case 'A':
+        spec[n++] = 'L';
+        spec[n++] = *f;
+        spec[n] = '\0';
+        printf(spec, float_arg(argv[0], NEXT()));
+        break;
+      case 'c':
+        strcpy(&spec[n], "c");
+        printf(spec, *NEXT());
+        break;
+      case 's':
+        strcpy(&spec[n], "s");
+        printf(spec, NEXT());
+        break;
+      case 'q':
+        quote(NEXT());
+        break;
+      case 'b': {
+        const char *s = NEXT();
+        while (*s) {
+          if (*s == '\\') {
+            s++;
+            if (!unescape(&s, OCTAL_EITHER)) {
+              return printf_status;
+            }
+          } else {
+            putchar(*s++);
+          }
+        }
+        break;
+      }
+      case '\0':
+        fprintf(stderr, "%s: %s: invalid conversion specification\n", argv[0], format);
+        return 1;
+      default:
+        fprintf(stderr, "%s: %%%c: invalid conversion specification\n", argv[0], *f);
+        return 1;
+      }
+    }
+    if (args == first) {
+      // Nothing in the format took an argument
+      break;
+    }
+  } while (args < end);
+#undef NEXT
+
+  return printf_status;
+}
+
+/*
+ * test EXPRESSION
+ * [ EXPRESSION ]
+ *
+ * Exits 0 if the expression is true, 1 if it is false and 2 if it is
+ * not a valid expression. As in coreutils, up to four arguments are
+ * taken apart by how many there are, which is what stops "test -n"
+ * or "test ! = x" being syntax errors. Beyond that it is -o over -a
+ * over ! over primaries, with ( ) for grouping
+ */
+typedef struct {
+  char **argv;
+  int argc;
+  int pos;
+  const char *name;
+  int error;
+} test_t;
+
+static int test_or(test_t *t);
+
+static void
+test_error(test_t *t, const char *message, const char *arg)
+{
+  if (!t->error) {
+    if (arg) {
+      fprintf(stderr, "%s: %s '%s'\n", t->name, message, arg);
+    } else {
+      fprintf(stderr, "%s: %s\n", t->name, message);
+    }
+  }
+  t->error = 1;
+}
+
+static intmax_t
+test_integer(test_t *t, const char *arg)
+{
+  const char *s = arg;
+  char *end;
+  intmax_t v;
+
+  while (isspace((unsigned char)*s)) {
+    s++;
+  }
+  errno = 0;
+  v = strtoimax(s, &end, 10);
+  while (isspace((unsigned char)*end)) {
+    end++;
+  }
+  if (end == s || *end || errno || !(isdigit((unsigned char)*s) || *s == '-' || *s == '+')) {
+    test_error(t, "invalid integer", arg);
+  }
+  return v;
+}
+
+static int
+unary(const char *op)
+{
+  return op[0] == '-' && op[1] && !op[2] && strchr("bcdefgGhLknOprsStuwxz", op[1]);
+}
+
+static int
+binary(const char *op)
+{
+  static const char *ops[] = {
+    "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+    "-nt", "-ot", "-ef", NULL
+  };
+  int i;
+  for (i = 0; ops[i]; i++) {
+    if (strcmp(op, ops[i]) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int
+test_unary(test_t *t, char op, const char *arg)
+{
+  struct stat st;
+
+  switch (op) {
+  case 'n': return *arg != '\0';
+  case 'z': return *arg == '\0';
+  case 't': return isatty((int)test_integer(t, arg));
+  case 'r': return access(arg, R_OK) == 0;
+  case 'w': return access(arg, W_OK) == 0;
+  case 'x': return access(arg, X_OK) == 0;
+  case 'h':
+  case 'L': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+  }
+  if (stat(arg, &st) != 0) {
+    return 0;
+  }
+  switch (op) {
+  case 'b': return S_ISBLK(st.st_mode);
+  case 'c': return S_ISCHR(st.st_mode);
+  case 'd': return S_ISDIR(st.st_mode);
+  case 'e': return 1;
+  case 'f': return S_ISREG(st.st_mode);
+  case 'g': return (st.st_mode & S_ISGID) != 0;
+  case 'G': return st.st_gid == getegid();
+  case 'k': return (st.st_mode & S_ISVTX) != 0;
+  case 'O': return st.st_uid == geteuid();
+  case 'p': return S_ISFIFO(st.st_mode);
+  case 's': return st.st_size > 0;
+  case 'S': return S_ISSOCK(st.st_mode);
+  case 'u': return (st.st_mode & S_ISUID) != 0;
+  }
+  return 0;
+}
+
+static int
+newer(struct stat *a, struct stat *b)
+{
+  return a->st_mtim.tv_sec > b->st_mtim.tv_sec ||
+         (a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+          a->st_mtim.tv_nsec > b->st_mtim.tv_nsec);
+}
+
+static int
+test_binary(test_t *t, const char *l, const char *op, const char *r)
+{
+  struct stat a, b;
+  int la, rb;
+
+  if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) {
+    return strcmp(l, r) == 0;
+  } else if (strcmp(op, "!=") == 0) {
+    return strcmp(l, r) != 0;
+  } else if (strcmp(op, "<") == 0) {
+    return strcoll(l, r) < 0;
+  } else if (strcmp(op, ">") == 0) {
+    return strcoll(l, r) > 0;
+  } else if (op[1] == 'e' && op[2] == 'f') {
+    return stat(l, &a) == 0 && stat(r, &b) == 0 &&
+           a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+  } else if (op[1] == 'n' && op[2] == 't') {
+    la = stat(l, &a) == 0;
+    rb = stat(r, &b) == 0;
+    return la && (!rb || newer(&a, &b));
+  } else if (op[1] == 'o' && op[2] == 't') {
+    la = stat(l, &a) == 0;
+    rb = stat(r, &b) == 0;
+    return rb && (!la || newer(&b, &a));
+  } else {
+    intmax_t x = test_integer(t, l), y = test_integer(t, r);
+    switch (op[1] * 256 + op[2]) {
+    case 'e' * 256 + 'q': return x == y;
+    case 'n' * 256 + 'e': return x != y;
+    case 'l' * 256 + 't': return x < y;
+    case 'l' * 256 + 'e': return x <= y;
+    case 'g' * 256 + 't': return x > y;
+    case 'g' * 256 + 'e': return x >= y;
+    }
+  }
+  return 0;
+}
+
+#define LEFT(t)   ((t)->argc - (t)->pos)
+#define ARG(t, i) ((t)->argv[(t)->pos + (i)])
+
+static int
+test_primary(test_t *t)
+{
+  int v;
+
+  if (LEFT(t) <= 0) {
+    test_error(t, "argument expected", NULL);
+    return 0;
+  }
+  if (strcmp(ARG(t, 0), "(") == 0) {
+    t->pos++;
+    v = test_or(t);
+    if (LEFT(t) <= 0 || strcmp(ARG(t, 0), ")") != 0) {
+      test_error(t, "')' expected", NULL);
+      return 0;
+    }
+    t->pos++;
+    return v;
+  }
+  if (LEFT(t) >= 3 && binary(ARG(t, 1))) {
+    v = test_binary(t, ARG(t, 0), ARG(t, 1), ARG(t, 2));
+    t->pos += 3;
+    return v;
+  }
+  if (unary(ARG(t, 0))) {
+    if (LEFT(t) < 2) {
+      test_error(t, "missing argument after", ARG(t, 0));
+      return 0;
+    }
+    v = test_unary(t, ARG(t, 0)[1], ARG(t, 1));
+    t->pos += 2;
+    return v;
+  }
+  return *t->argv[t->pos++] != '\0';
+}
+
+static int
+test_not(test_t *t)
+{
+  int negate = 0;
+  while (LEFT(t) > 0 && strcmp(ARG(t, 0), "!") == 0) {
+    negate = !negate;
+    t->pos++;
+  }
+  return test_primary(t) ^ negate;
+}
+
+static int
+test_and(test_t *t)
+{
+  int v = test_not(t);
+  while (LEFT(t) > 0 && strcmp(ARG(t, 0), "-a") == 0) {
+    t->pos++;
+    v = test_not(t) & v;
+  }
+  return v;
+}
+
+static int
+test_or(test_t *t)
+{
+  int v = test_and(t);
+  while (LEFT(t) > 0 && strcmp(ARG(t, 0), "-o") == 0) {
+    t->pos++;
+    v = test_and(t) | v;
+  }
+  return v;
+}
+
+/*
+ * The POSIX rules for a given number of arguments, falling back on the
+ * full grammar for anything they don't cover
+ */
+static int
+test_expr(test_t *t)
+{
+  int n = LEFT(t);
+
+  switch (n) {
+  case 0:
+    return 0;
+  case 1:
+    t->pos++;
+    return *ARG(t, -1) != '\0';
+  case 2:
+    if (strcmp(ARG(t, 0), "!") == 0) {
+      t->pos += 2;
+      return *ARG(t, -1) == '\0';
+    }
+    if (!unary(ARG(t, 0))) {
+      test_error(t, "unary operator expected", ARG(t, 0));
+      return 0;
+    }
+    break;
+  case 3:
+    if (binary(ARG(t, 1))) {
+      t->pos += 3;
+      return test_binary(t, ARG(t, -3), ARG(t, -2), ARG(t, -1));
+    }
+    if (strcmp(ARG(t, 0), "!") == 0) {
+      t->pos++;
+      return !test_expr(t);
+    }
+    if (strcmp(ARG(t, 0), "(") == 0 && strcmp(ARG(t, 2), ")") == 0) {
+      t->pos += 3;
+      return *ARG(t, -2) != '\0';
+    }
+    break;
+  case 4:
+    if (strcmp(ARG(t, 0), "!") == 0) {
+      t->pos++;
+      return !test_expr(t);
+    }
+    if (strcmp(ARG(t, 0), "(") == 0 && strcmp(ARG(t, 3), ")") == 0) {
+      t->pos++;
+      t->argc--;
+      int v = test_expr(t);
+      t->argc++;
+      t->pos++;
+      return v;
+    }
+    break;
+  }
+  return test_or(t);
+}
+
+int lsh_test(int argc, char **argv)
+{
+  test_t t = { argv, argc, 1, argv[0], 0 };
+  int v;
+
+  if (strcmp(argv[0], "[") == 0) {
+    if (strcmp(argv[argc - 1], "]") != 0) {
+      fprintf(stderr, "[: missing ']'\n");
+      return 2;
+    }
+    t.argc--;
+  }
+  v = test_expr(&t);
+  if (!t.error && LEFT(&t) > 0) {
+    test_error(&t, "extra argument", ARG(&t, 0));
+  }
+  return t.error ? 2 : !v;
+}
+#undef LEFT
+#undef ARG
+#endif /* LSH_ENABLE_BUILTINS */
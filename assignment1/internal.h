@@ -29,4 +29,29 @@ lsh_not_impl(const char *cmd);
 int
 lsh_cd(int argc, char **argv);
 #endif
- 
+
+#ifdef LSH_ENABLE_BUILTINS
+int
+lsh_true(int argc, char **argv);
+
+int
+lsh_false(int argc, char **argv);
+
+int
+lsh_echo(int argc, char **argv);
+
+int
+lsh_printf(int argc, char **argv);
+
+int
+lsh_pwd(int argc, char **argv);
+
+int
+lsh_test(int argc, char **argv);
+
+int
+lsh_basename(int argc, char **argv);
+
+int
+lsh_dirname(int argc, char **argv);
+#endif
@@ -0,0 +1,655 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * Background jobs (the 'jobs', 'wait', 'fg' and 'bg' internal commands)
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/signalfd.h>
+
+#include "arena.h"
+#include "parse.h"
+#include "execute.h"
+#include "job.h"
+
+/*
+ * Every background job is kept here until it has finished and been
+ * reported. A job is found by its id through an array indexed by it,
+ * and by the pid of any of its processes still running through a hash
+ * of them, so neither a %n nor a child exiting means a search through
+ * hundreds of jobs.
+ *
+ * Children are reaped as soon as they change state with no polling at
+ * all. SIGCHLD is blocked and read from a signalfd instead, which the
+ * read loop waits on alongside its input
+ */
+typedef struct job {
+  int id;
+  pid_t pgid;                   // -1 if we have no job control
+  pid_t *pids;                  // The last is the one whose status counts
+  int n;
+  int live;                     // Processes that have not exited
+  int stopped;                  // How many of those are stopped
+  int status;
+  char *command;
+} job_t;
+
+typedef struct {
+  pid_t pid;                    // 0 if the slot is free
+  int stopped;
+  job_t *job;
+} proc_t;
+
+static job_t **jobs;            // By id. 0 is never used
+static int size;                // Of jobs[]
+static int top;                 // Highest id in use, the current job
+static int count;               // Jobs in the table
+
+static proc_t *procs;           // Open addressing, linear probing
+static unsigned psize;          // A power of two
+static unsigned pused;
+
+static int sigfd = -1;
+static int tty;                 // Input is a terminal we can poll
+static int announce;            // Tell the user about jobs as they go
+
+static unsigned
+home(pid_t pid)
+{
+  return ((unsigned)pid * 2654435761u) & (psize - 1);
+}
+
+static proc_t *
+find(pid_t pid)
+{
+  unsigned i;
+
+  for (i = psize ? home(pid) : 0; psize && procs[i].pid; i = (i + 1) & (psize - 1)) {
+    if (procs[i].pid == pid) {
+      return &procs[i];
+    }
+  }
+  return NULL;
+}
+
+static void
+place(proc_t *proc)
+{
+  unsigned i;
+
+  for (i = home(proc->pid); procs[i].pid; i = (i + 1) & (psize - 1))
+    ;
+  procs[i] = *proc;
+  pused++;
+}
+
+/*
+ * Keep the hash at most half full
+ */
+static void
+insert(pid_t pid, job_t *job)
+{
+  proc_t proc = { pid, 0, job };
+
+  if ((pused + 1) * 2 > psize) {
+    proc_t *old = procs;
+    unsigned n = psize, i;
+
+    psize = psize ? psize * 2 : 64;
+    procs = calloc(psize, sizeof(proc_t));
+    pused = 0;
+    for (i = 0; i < n; i++) {
+      if (old[i].pid) {
+        place(&old[i]);
+      }
+    }
+    free(old);
+  }
+  place(&proc);
+}
+
+/*
+ * Take a process out of the hash. Rather than leave a marker, any that
+ * follow it in the same run are moved back into the gap if their own
+ * slot is not between it and them
+ */
+static void
+erase(proc_t *proc)
+{
+  unsigned mask = psize - 1, i = proc - procs, j = i;
+
+  pused--;
+  for (;;) {
+    procs[i].pid = 0;
+    for (;;) {
+      unsigned k;
+      j = (j + 1) & mask;
+      if (!procs[j].pid) {
+        return;
+      }
+      k = home(procs[j].pid);
+      if (i <= j ? (k <= i || k > j) : (k <= i && k > j)) {
+        break;
+      }
+    }
+    procs[i] = procs[j];
+    i = j;
+  }
+}
+
+/*
+ * One of a job's processes is no more
+ */
+static void
+forget(proc_t *proc, int status)
+{
+  job_t *job = proc->job;
+
+  if (proc->stopped) {
+    job->stopped--;
+  }
+  if (proc->pid == job->pids[job->n - 1]) {
+    job->status = status;
+  }
+  job->live--;
+  erase(proc);
+}
+
+static void
+stop(proc_t *proc)
+{
+  if (!proc->stopped) {
+    proc->stopped = 1;
+    proc->job->stopped++;
+  }
+}
+
+/*
+ * Note the change of state waitpid() told us about
+ */
+static void
+record(pid_t pid, int st)
+{
+  proc_t *proc = find(pid);
+
+  if (!proc) {
+    return;
+  }
+  if (WIFSTOPPED(st)) {
+    stop(proc);
+  } else if (WIFCONTINUED(st)) {
+    if (proc->stopped) {
+      proc->stopped = 0;
+      proc->job->stopped--;
+    }
+  } else {
+    forget(proc, WIFEXITED(st) ? WEXITSTATUS(st) : 128 + WTERMSIG(st));
+  }
+}
+
+static void
+job_free(job_t *job)
+{
+  jobs[job->id] = NULL;
+  count--;
+  while (top > 0 && !jobs[top]) {
+    top--;
+  }
+  free(job->pids);
+  free(job->command);
+  free(job);
+}
+
+/*
+ * A job as the user would have typed it
+ */
+static char *
+describe(pipeline_t *pipeline)
+{
+  command_t *command;
+  char *text = NULL;
+  size_t len;
+  FILE *f = open_memstream(&text, &len);
+  int i;
+
+  for (command = pipeline->commands; command; command = command->next) {
+    for (i = 0; i < command->argc; i++) {
+      fprintf(f, i ? " %s" : "%s", command->argv[i]);
+    }
+    if (command->from) {
+      fprintf(f, " < %s", command->from);
+    }
+    if (command->to) {
+      fprintf(f, " %s %s", command->append ? ">>" : ">", command->to);
+    }
+    if (command->next) {
+      fprintf(f, " | ");
+    }
+  }
+  fclose(f);
+  return text;
+}
+
+static void
+show(job_t *job, int pids)
+{
+  char state[16];
+  int i;
+
+  if (job->live == 0) {
+    if (job->status) {
+      snprintf(state, sizeof(state), "Exit %d", job->status);
+    } else {
+      strcpy(state, "Done");
+    }
+  } else {
+    strcpy(state, job->stopped == job->live ? "Stopped" : "Running");
+  }
+  printf("[%d]%c  ", job->id, job->id == top ? '+' : ' ');
+  for (i = 0; pids && i < job->n; i++) {
+    printf("%d ", job->pids[i]);
+  }
+  printf("%-24s%s\n", state, job->command);
+}
+
+void
+job_init(int interactive)
+{
+  sigset_t set;
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &set, NULL);
+  sigfd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+  tty = interactive && isatty(STDIN_FILENO);
+  announce = interactive;
+}
+
+/*
+ * Add the n processes started for a background pipeline as a job.
+ * Returns its id or -1 if none of them started
+ */
+int
+job_add(pid_t pgid, pid_t *pids, int n, pipeline_t *pipeline)
+{
+  job_t *job = calloc(1, sizeof(job_t));
+  int i;
+
+  job->pids = malloc(n * sizeof(pid_t));
+  for (i = 0; i < n; i++) {
+    if (pids[i] > 0) {
+      job->pids[job->n++] = pids[i];
+    }
+  }
+  if (job->n == 0) {
+    free(job->pids);
+    free(job);
+    return -1;
+  }
+  job->id = top + 1;
+  if (job->id >= size) {
+    int grown = size ? size * 2 : 16;
+    jobs = realloc(jobs, grown * sizeof(job_t *));
+    memset(&jobs[size], 0, (grown - size) * sizeof(job_t *));
+    size = grown;
+  }
+  jobs[job->id] = job;
+  top = job->id;
+  count++;
+  job->pgid = pgid > 0 ? pgid : -1;
+  job->live = job->n;
+  job->command = describe(pipeline);
+  for (i = 0; i < job->n; i++) {
+    insert(job->pids[i], job);
+  }
+  if (announce) {
+    printf("[%d] %d\n", job->id, job->pids[job->n - 1]);
+  }
+  return job->id;
+}
+
+/*
+ * A foreground pipeline becomes a job when one of its processes, pid,
+ * stops. None of pids is to have been waited for yet but pid, whose
+ * stop was. Returns the exit code as fg would
+ */
+int
+job_stopped(pid_t pgid, pid_t *pids, int n, pipeline_t *pipeline, pid_t pid)
+{
+  int was = announce, id, i, st;
+  proc_t *proc;
+  job_t *job;
+
+  // It is not started in the background, so there is no [n] pid
+  announce = 0;
+  id = job_add(pgid, pids, n, pipeline);
+  announce = was;
+  if (id < 0) {
+    return 128 + SIGTSTP;
+  }
+  job = jobs[id];
+  if ((proc = find(pid)) != NULL) {
+    stop(proc);
+  }
+  // The rest of its group are being stopped along with it
+  for (i = 0; i < job->n; i++) {
+    while ((proc = find(job->pids[i])) != NULL && !proc->stopped) {
+      pid_t got = waitpid(proc->pid, &st, WUNTRACED);
+      if (got < 0 && errno == EINTR) {
+        continue;
+      } else if (got < 0) {
+        forget(proc, 127);
+        break;
+      }
+      record(got, st);
+    }
+  }
+  printf("\n");
+  show(job, 0);
+  return 128 + SIGTSTP;
+}
+
+/*
+ * Collect every child that has changed state, without blocking. There
+ * is nothing to do, not even a system call, until a job has been
+ * started and then only one until a SIGCHLD says otherwise
+ */
+void
+job_reap(void)
+{
+  struct signalfd_siginfo info;
+  pid_t pid;
+  int st;
+
+  if (count == 0 || read(sigfd, &info, sizeof(info)) <= 0) {
+    return;
+  }
+  // Several children may have changed for the one signal
+  while (read(sigfd, &info, sizeof(info)) > 0)
+    ;
+  while ((pid = waitpid(-1, &st, WNOHANG | WUNTRACED | WCONTINUED)) > 0) {
+    record(pid, st);
+  }
+}
+
+/*
+ * Report, then forget, the jobs that have finished
+ */
+void
+job_notify(void)
+{
+  int id;
+
+  job_reap();
+  for (id = top; count > 0 && id > 0; id--) {
+    job_t *job = jobs[id];
+    if (job && job->live == 0) {
+      if (announce) {
+        show(job, 0);
+      }
+      job_free(job);
+    }
+  }
+}
+
+/*
+ * Wait for input on fd, reaping any jobs that change in the meantime
+ * so that none of them is left a zombie while the user thinks
+ */
+void
+job_await(int fd)
+{
+  struct pollfd fds[2] = { { fd, POLLIN, 0 }, { sigfd, POLLIN, 0 } };
+
+  fflush(stdout);
+  while (tty && count > 0) {
+    if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+      break;
+    }
+    if (fds[1].revents & POLLIN) {
+      job_reap();
+    }
+    if (fds[0].revents) {
+      break;
+    }
+  }
+}
+
+/*
+ * A job from %n, %% or %+ (the current job), or a pid
+ */
+static job_t *
+lookup(const char *spec)
+{
+  char *end;
+  long n;
+  int id, i;
+
+  if (!spec || strcmp(spec, "%") == 0 || strcmp(spec, "%%") == 0 ||
+      strcmp(spec, "%+") == 0) {
+    return top ? jobs[top] : NULL;
+  }
+  if (*spec == '%') {
+    n = strtol(spec + 1, &end, 10);
+    return *end == '\0' && n > 0 && n <= top ? jobs[n] : NULL;
+  }
+  n = strtol(spec, &end, 10);
+  if (*end != '\0' || n <= 0) {
+    return NULL;
+  }
+  proc_t *proc = find(n);
+  if (proc) {
+    return proc->job;
+  }
+  // It may have exited but still be part of a job not yet reported
+  for (id = 1; id <= top; id++) {
+    for (i = 0; jobs[id] && i < jobs[id]->n; i++) {
+      if (jobs[id]->pids[i] == n) {
+        return jobs[id];
+      }
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Wait for a job to finish or, if options has WUNTRACED, to stop
+ */
+static void
+finish(job_t *job, int options)
+{
+  proc_t *proc;
+  int i, st;
+
+  for (i = 0; i < job->n; i++) {
+    while ((proc = find(job->pids[i])) != NULL) {
+      pid_t pid = waitpid(proc->pid, &st, options);
+      if (pid < 0 && errno == EINTR) {
+        continue;
+      } else if (pid < 0) {
+        // Not ours to wait for after all
+        forget(proc, 127);
+        break;
+      }
+      record(pid, st);
+      if (WIFSTOPPED(st)) {
+        return;
+      }
+    }
+  }
+}
+
+static void
+resume(job_t *job)
+{
+  int i;
+
+  for (i = 0; i < job->n; i++) {
+    proc_t *proc = find(job->pids[i]);
+    if (proc) {
+      proc->stopped = 0;
+      if (job->pgid < 0) {
+        kill(proc->pid, SIGCONT);
+      }
+    }
+  }
+  job->stopped = 0;
+  if (job->pgid > 0) {
+    kill(-job->pgid, SIGCONT);
+  }
+}
+
+static job_t *
+job_arg(const char *cmd, const char *spec)
+{
+  job_t *job = lookup(spec);
+
+  if (!job) {
+    fprintf(stderr, "%s: %s: no such job\n", cmd, spec ? spec : "current");
+  }
+  return job;
+}
+
+/*
+ * jobs [-l|-p]
+ *
+ * List the jobs, with the pids of their processes after -l or only
+ * those after -p. Finished jobs are forgotten once listed
+ */
+int
+lsh_jobs(int argc, char **argv)
+{
+  int pids = argc > 1 && strcmp(argv[1], "-l") == 0;
+  int only = argc > 1 && strcmp(argv[1], "-p") == 0;
+  int id, i;
+
+  job_reap();
+  for (id = 1; id <= top; id++) {
+    job_t *job = jobs[id];
+    if (!job) {
+      continue;
+    }
+    if (only) {
+      for (i = 0; i < job->n; i++) {
+        printf("%d\n", job->pids[i]);
+      }
+    } else {
+      show(job, pids);
+    }
+    if (job->live == 0) {
+      job_free(job);
+    }
+  }
+  return 0;
+}
+
+/*
+ * wait [%n|pid ...]
+ *
+ * Wait for the jobs given, or all of them, to finish. A pid stands for
+ * the whole of its job. The exit code is that of the last job given,
+ * or 127 if it is not one of ours
+ */
+int
+lsh_wait(int argc, char **argv)
+{
+  int status = 0, i, id;
+
+  if (argc == 1) {
+    for (id = 1; id <= top; id++) {
+      if (jobs[id]) {
+        finish(jobs[id], 0);
+      }
+    }
+    for (id = top; id > 0; id--) {
+      if (jobs[id]) {
+        job_free(jobs[id]);
+      }
+    }
+    return 0;
+  }
+  for (i = 1; i < argc; i++) {
+    job_t *job = lookup(argv[i]);
+    if (!job) {
+      fprintf(stderr, "%s: %s: not a child of this shell\n", argv[0], argv[i]);
+      status = 127;
+      continue;
+    }
+    finish(job, 0);
+    status = job->status;
+    job_free(job);
+  }
+  return status;
+}
+
+/*
+ * fg [%n]
+ *
+ * Give a job the terminal, starting it again if it was stopped, and
+ * wait for it to finish or stop again
+ */
+int
+lsh_fg(int argc, char **argv)
+{
+  job_t *job = job_arg(argv[0], argv[1]);
+  int status;
+
+  if (!job) {
+    return 1;
+  }
+  printf("%s\n", job->command);
+  fflush(stdout);
+  execute_foreground(job->pgid);
+  resume(job);
+  finish(job, WUNTRACED);
+  execute_foreground(getpgrp());
+  if (job->live > 0) {
+    printf("\n");
+    show(job, 0);
+    return 128 + SIGTSTP;
+  }
+  status = job->status;
+  job_free(job);
+  return status;
+}
+
+/*
+ * bg [%n]
+ *
+ * Start a stopped job again in the background
+ */
+int
+lsh_bg(int argc, char **argv)
+{
+  job_t *job = job_arg(argv[0], argv[1]);
+
+  if (!job) {
+    return 1;
+  }
+  resume(job);
+  printf("[%d]%c %s &\n", job->id, job->id == top ? '+' : ' ', job->command);
+  return 0;
+}
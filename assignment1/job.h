@@ -0,0 +1,50 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * Job table interface
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+void
+job_init(int interactive);
+
+int
+job_add(pid_t pgid, pid_t *pids, int n, pipeline_t *pipeline);
+
+int
+job_stopped(pid_t pgid, pid_t *pids, int n, pipeline_t *pipeline, pid_t pid);
+
+void
+job_reap(void);
+
+void
+job_notify(void);
+
+void
+job_await(int fd);
+
+int
+lsh_jobs(int argc, char **argv);
+
+int
+lsh_wait(int argc, char **argv);
+
+int
+lsh_fg(int argc, char **argv);
+
+int
+lsh_bg(int argc, char **argv);
@@ -28,62 +28,99 @@
 #include <unistd.h>
 #include <libgen.h>
 #include <ctype.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
-#include <regex.h>
+#include <sys/mman.h>
 
 #include "symtab.h"
+#include "arena.h"
 #include "tokenise.h"
+#include "parse.h"
+#include "phase.h"
 #include "internal.h"
+#include "execute.h"
+#include "hash.h"
+#include "arith.h"
+#include "expand.h"
+#include "env.h"
+#include "job.h"
+#include "parallel.h"
+#include "stats.h"
+#include "zygote.h"
+#include "perf.h"
+#include "cache.h"
+#include "func.h"
+#include "lsh.h"
 
 #define SZ(t) (sizeof(t) / sizeof(t[0]))
 
 /*
- * You get the following number by running 'getconf ARG_MAX' on the shell
- * command line for your system. This is the value for the Arch Linux 
- * version we're using in this module
+ * Lines are read into a buffer that starts small and grows to fit the
+ * longest line seen, with no limit on how long one may be. Once a line
+ * much longer than usual has been run, the memory is given back rather
+ * than kept for the rest of the session
  */
-#ifndef ARG_MAX
-#define ARG_MAX 2097152                
-#endif
+#define LINE_START 256
+#define LINE_KEEP  65536
 
 /*
  * For simplicity of implementation, this cmd buffer is visible to all functions
  * but you should use the macros below to update and read from the buffer itself
  */
-static char buffer[ARG_MAX + 1];
-static char *cmd = buffer;        // Initially the same as buffer but can change
+static char *buffer;
+static size_t room;               // Allocated size of buffer
+static char *cmd;                 // Initially the same as buffer but can change
 #define TRIM(bp)   bp = trim(bp)
 #define RESET(bp)  bp = buffer
-#define READ(bp)   fgets(bp, sizeof(buffer), stdin)
+#define READ(bp)   (bp = read_line())
+
+/*
+ * Everything allocated while parsing and running a line comes from
+ * here and is released in one go before the next line is read
+ */
+static arena_t arena;
 
 /*
  * The 'current' head of the symbol table
  */
-static symbol_t *symtab;
+symtab_t *symtab;
 
 #ifndef PS1
 // Default prompt string if not provided
 #define PS1 "lsh>> "
 #endif
 
+// Prompt for the rest of a function being defined
+#define PS2 "> "
+
 #ifdef LSH_ENABLE_EXTERNAL
-// Default PATH
-#ifndef PATH
-#define PATH "/usr/local/bin:/bin:/usr/bin"
+/*
+ * How external commands are started: fork, vfork or posix_spawn.
+ * This can be changed at run time by setting LSH_SPAWN
+ */
+#ifndef LSH_SPAWN
+#define LSH_SPAWN "fork"
 #endif
 #endif
 
 static char *progname;
 
+/*
+ * Whether we are talking to a person. Decided once at start up rather
+ * than asking isatty() for every prompt, and never true for a script
+ * or a -c command
+ */
+static int interactive;
+
 /*
  * TODO Add internal commands to support the copyright and license commands
  * noted in the following message
  */
 static void license()
 {
-  if (isatty(STDOUT_FILENO)) {
+  if (interactive) {
     fprintf(stderr, "%s: Copyright (C) 2012 Brian Gillespie\n"
                     "This program comes with ABSOLUTELY NO WARRANTY; This is free software,\n"
                     "and you are welcome to redistribute it under certain conditions;\n"
@@ -94,7 +131,7 @@ static void license()
 // Do exit cleanup
 static void exiting(void)
 {
-  if (isatty(STDOUT_FILENO)) {
+  if (interactive) {
     fprintf(stdout, "Bye\n");
   }
   free(progname);
@@ -108,15 +145,71 @@ static void halt(int argc, char **argv)
 
 static void init(void)
 {
+  symtab_notify(hash_changed);
+#ifdef LSH_ENABLE_ENV
+  extern char **environ;
+  env_import(environ);
+#endif /* LSH_ENABLE_ENV */
   symtab = symtab_set(symtab, "PS1", SYM_VAR, PS1);
+  symtab = symtab_export(symtab, "PS1", 1);
 #ifdef LSH_ENABLE_EXTERNAL
-  symtab = symtab_set(symtab, "PATH", SYM_VAR, PATH);
+  // Anything the environment gave us is kept
+  if (!symtab_lookup(symtab, "PATH")) {
+    symtab = symtab_set(symtab, "PATH", SYM_VAR, PATH);
+  }
+  if (!symtab_lookup(symtab, "LSH_SPAWN")) {
+    symtab = symtab_set(symtab, "LSH_SPAWN", SYM_VAR, LSH_SPAWN);
+  }
 #endif /* LSH_ENABLE_EXTERNAL */
 
   symtab = symtab_set(symtab, "exit", SYM_INTERNAL, halt);
+  symtab = symtab_set(symtab, "hash", SYM_INTERNAL, lsh_hash);
+#ifdef LSH_ENABLE_JOBS
+  symtab = symtab_set(symtab, "jobs", SYM_INTERNAL, lsh_jobs);
+  symtab = symtab_set(symtab, "wait", SYM_INTERNAL, lsh_wait);
+  symtab = symtab_set(symtab, "fg", SYM_INTERNAL, lsh_fg);
+  symtab = symtab_set(symtab, "bg", SYM_INTERNAL, lsh_bg);
+#endif /* LSH_ENABLE_JOBS */
+#ifdef LSH_ENABLE_TRACE
+  symtab = symtab_set(symtab, "trace", SYM_INTERNAL, lsh_trace);
+#endif /* LSH_ENABLE_TRACE */
+#ifdef LSH_ENABLE_FUNCS
+  func_init();
+  symtab = symtab_set(symtab, "return", SYM_INTERNAL, lsh_return);
+  symtab = symtab_set(symtab, "break", SYM_INTERNAL, lsh_break);
+  symtab = symtab_set(symtab, "continue", SYM_INTERNAL, lsh_continue);
+#endif /* LSH_ENABLE_FUNCS */
+#ifdef LSH_ENABLE_STATS
+  symtab = symtab_set(symtab, "time", SYM_INTERNAL, lsh_time);
+  symtab = symtab_set(symtab, "stats", SYM_INTERNAL, lsh_stats);
+#endif /* LSH_ENABLE_STATS */
+#ifdef LSH_ENABLE_PERF
+  symtab = symtab_set(symtab, "perfstat", SYM_INTERNAL, lsh_perfstat);
+#endif /* LSH_ENABLE_PERF */
+#ifdef LSH_ENABLE_PARALLEL
+  symtab = symtab_set(symtab, "parallel", SYM_INTERNAL, lsh_parallel);
+#endif /* LSH_ENABLE_PARALLEL */
+#ifdef LSH_ENABLE_ENV
+  symtab = symtab_set(symtab, "export", SYM_INTERNAL, lsh_export);
+  symtab = symtab_set(symtab, "env", SYM_INTERNAL, lsh_env);
+#endif /* LSH_ENABLE_ENV */
 #ifdef LSH_ENABLE_CD
   symtab = symtab_set(symtab, "cd", SYM_INTERNAL, lsh_cd);
 #endif /* LSH_ENABLE_CD */
+#ifdef LSH_ENABLE_ARITH
+  symtab = symtab_set(symtab, "let", SYM_INTERNAL, lsh_let);
+#endif /* LSH_ENABLE_ARITH */
+#ifdef LSH_ENABLE_BUILTINS
+  symtab = symtab_set(symtab, "true", SYM_INTERNAL, lsh_true);
+  symtab = symtab_set(symtab, "false", SYM_INTERNAL, lsh_false);
+  symtab = symtab_set(symtab, "echo", SYM_INTERNAL, lsh_echo);
+  symtab = symtab_set(symtab, "printf", SYM_INTERNAL, lsh_printf);
+  symtab = symtab_set(symtab, "pwd", SYM_INTERNAL, lsh_pwd);
+  symtab = symtab_set(symtab, "test", SYM_INTERNAL, lsh_test);
+  symtab = symtab_set(symtab, "[", SYM_INTERNAL, lsh_test);
+  symtab = symtab_set(symtab, "basename", SYM_INTERNAL, lsh_basename);
+  symtab = symtab_set(symtab, "dirname", SYM_INTERNAL, lsh_dirname);
+#endif /* LSH_ENABLE_BUILTINS */
 }
 
 // Show the command prompt
@@ -126,9 +219,22 @@ static void prompt(void)
    * We only want to show the prompt string if we are outputting
    * to a terminal and not being redirected to a pipe or file
    */
-  if (isatty(STDOUT_FILENO)) {
+  if (interactive) {
+#ifdef LSH_ENABLE_JOBS
+    job_notify();
+#endif
+#ifdef LSH_ENABLE_FUNCS
+    if (func_pending(0)) {
+      fprintf(stdout, "%s", (char *)symtab_fetch(symtab, "PS2", PS2));
+      return;
+    }
+#endif
     fprintf(stdout, "%s", (char *)symtab_fetch(symtab, "PS1", PS1));
   }
+#ifdef LSH_ENABLE_JOBS
+  // Children that exit while we wait for the next line are reaped now
+  job_await(STDIN_FILENO);
+#endif
 }
 
 /*
@@ -140,193 +246,849 @@ trim(char *str)
   char *start, *end;
   for (start = str; isspace(*start); start++)
     ;
-  for (end = &str[strlen(str) - 1]; isspace(*end); end--)
-    *end = '\0';
+  for (end = start + strlen(start); end > start && isspace(end[-1]); end--)
+    end[-1] = '\0';
   return start;
 }
 
+/*
+ * Read the next line of standard input, however long, into the buffer.
+ * Returns NULL at the end of the input
+ */
+static char *
+read_line(void)
+{
+  if (room > LINE_KEEP || !buffer) {
+    free(buffer);
+    room = LINE_START;
+    buffer = malloc(room);
+  }
+  return getline(&buffer, &room, stdin) < 0 ? NULL : buffer;
+}
+
+#ifdef LSH_ENABLE_FUNCS
+/*
+ * Run one line of a body, from a copy in the arena that is let go of
+ * as soon as it has been run, since expanding it writes on it
+ */
 static int
-internal(int argc, char *argv[])
+simple(pipeline_t *line)
 {
-  char *name = argv[0];
-  symbol_t *symbol = symtab_lookup(symtab, name);
-  int status = -1;
+  arena_mark_t mark = arena_mark(&arena);
+  pipeline_t *copy = parse_copy(&arena, line, 0);
+  int status;
 
-  if (symbol && symbol->type == SYM_INTERNAL) {
-    status = ((internal_t)symbol->value)(argc, argv);
-  } else {
-#if !defined(LSH_ENABLE_EXTERNAL)
-    lsh_not_impl(argv[0]);
+  // The condition of an if or while is run as a line of its own
+  copy->keyword = K_NONE;
+  status = lsh_execute(copy);
+  arena_release(&arena, mark);
+#ifdef LSH_ENABLE_USERVARS
+  symtab = symtab_set_int(symtab, "?", status);
 #endif
-  }
   return status;
 }
 
-#ifdef LSH_ENABLE_EXTERNAL
 /*
- * Search the specified path to locate an executable binary
+ * After each time round a loop, whether to stop going round: for a
+ * break or a return, or a continue meant for a loop further out
  */
-static char
-*path_lookup(const char *path, const char *binary)
+static int
+stop(void)
 {
-  char *p = strdup(path);
-  char *saveptr;
-  char *token;
-  int binlen = strlen(binary);
-  char *which = (char *)path;
-
-  for (token = strtok_r(p, ":", &saveptr);
-       token != NULL;
-       token = strtok_r(NULL, ":", &saveptr)) {
-    token = trim(token);
-    char *execpath = malloc(strlen(token) + binlen + 2);
-    strcpy(execpath, token);
-    strcat(execpath, "/");
-    strcat(execpath, binary);
-    struct stat statbuf;
-    /*
-     * Although we check for the file's existance here, it is
-     * not a guarantee, if found, that it will still exist by
-     * the time we attempt to execute it. For the same reason,
-     * there is no point in checking whether it is executable
-     * as that might change too.
-     */
-    if (stat(execpath, &statbuf) == 0) {
-      which = execpath;
+  if (func_breaking) {
+    func_breaking--;
+    return 1;
+  }
+  if (func_continuing) {
+    return --func_continuing > 0;
+  }
+  return func_returning;
+}
+
+/*
+ * Run the lines of a body from up to to, each compound command among
+ * them as a whole, and return the exit code of the last command run.
+ * Nothing is parsed or searched for: each line is run from the copy
+ * stored when it was read and each loop or clause knows where it ends.
+ * A for loop's words are expanded once, before it starts, and its
+ * variable is set to each in turn, which writes over the one value
+ */
+static int
+block(func_t *func, int from, int to)
+{
+  int status = 0, i = from;
+
+  while (i < to && !func_returning && !func_breaking && !func_continuing) {
+    pipeline_t *line = func->body[i];
+    arena_mark_t mark = arena_mark(&arena);
+    command_t *command;
+    func_t *ready;
+    int end = func->jump[i], j;
+
+    switch (line->keyword) {
+    case K_NONE:
+      status = simple(line);
       break;
+    case K_IF:
+      // Try each condition until one is true, or there is an else
+      status = 0;
+      for (j = i; func->body[j]->keyword != K_FI; j = func->jump[j]) {
+        if (func->body[j]->keyword == K_ELSE || simple(func->body[j]) == 0) {
+          status = block(func, j + 1, func->jump[j]);
+          break;
+        }
+      }
+      while (func->body[j]->keyword != K_FI) {
+        j = func->jump[j];
+      }
+      end = j;
+      break;
+    case K_WHILE:
+      status = 0;
+      func_loops++;
+      while (simple(line) == 0) {
+        status = block(func, i + 1, end);
+        if (stop()) {
+          break;
+        }
+      }
+      func_loops--;
+      break;
+    case K_FOR:
+      status = 0;
+      command = parse_copy(&arena, line, 0)->commands;
+#ifdef LSH_ENABLE_USERVARS
+      if (command->expand && expand_command(&arena, command) < 0) {
+        status = 1;
+        break;
+      }
+#endif
+      func_loops++;
+      for (j = 1; j < command->argc; j++) {
+        symtab = symtab_set(symtab, command->argv[0], SYM_VAR, command->argv[j]);
+        status = block(func, i + 1, end);
+        if (stop()) {
+          break;
+        }
+      }
+      func_loops--;
+      break;
+    case K_FUNCTION:
+      // Defined afresh each time this runs, from its stored lines
+      for (j = i; j <= end; j++) {
+        func_collect(func->body[j], &ready);
+      }
+      status = 0;
+      break;
+    default:
+      // A then or a do
+      break;
+    }
+#ifdef LSH_ENABLE_USERVARS
+    // A compound command, not a then or do, leaves its own exit code
+    if (line->keyword != K_NONE && end != i) {
+      symtab = symtab_set_int(symtab, "?", status);
     }
-    free(execpath);
+#endif
+    arena_release(&arena, mark);
+    i = end + 1;
   }
-  free(p);
-  return which;
+  return status;
 }
 
+/*
+ * Run a function with argv as its positional parameters
+ */
 static int
-external(int argc, char **argv)
+call(func_t *func, int argc, char **argv)
 {
-    int rc = -1;
-    char *path;
-    extern char **environ;
-
-    pid_t pid = fork();
-    if (pid < 0) {
-      perror("fork");
-    } else if (pid == 0) {
-      /*
-       * If argc[0] contains no '/' character then we must lookup
-       * the PATH variable to find its path. Otherwise we can just
-       * call exec
-       */
-      if (index(argv[0], '/') == NULL) {
-        path = path_lookup(symtab_fetch(symtab, "PATH", PATH), argv[0]);
-      } else {
-        path = argv[0];
-      }
-      execve(path, argv, environ);
+  int status, loops = func_loops;
+
+  if (func_push(argc, argv) < 0) {
+    return 1;
+  }
+  // It may be defined again while it runs
+  func_hold(func);
+  // A break can't reach a loop outside the function
+  func_loops = 0;
+  status = block(func, 0, func->lines);
+  func_loops = loops;
+  func_returning = 0;
+  func_release(func);
+  func_pop();
+  return status;
+}
+#endif /* LSH_ENABLE_FUNCS */
+
+/*
+ * Make a <name>=<value>, <name>+=<value> or <name>=(<item> ...) setting
+ */
+static void
+setting(assign_t *assign)
+{
+  if (assign->items) {
+    symtab = assign->append ?
+             symtab_append(symtab, assign->name, assign->nitems, assign->items) :
+             symtab_set_array(symtab, assign->name, assign->nitems, assign->items);
+  } else if (assign->append) {
+    symbol_t *symbol = symtab_lookup(symtab, assign->name);
+    const char *old = symbol ? symtab_string(symbol) : NULL;
+    size_t len = old ? strlen(old) : 0;
+    char *value = arena_alloc(&arena, len + strlen(assign->value) + 1);
+
+    memcpy(value, old, len);
+    strcpy(&value[len], assign->value);
+    if (symbol && symbol->type == SYM_ARRAY && len > 0) {
       /*
-       * Shouldn't get here if above has been successful
+       * As in bash, it is the first item that is appended to. The rest
+       * are in the pool being replaced so have to be copied out first
        */
-      if (path && path != argv[0]) {
-        free(path);
+      array_t *array = symbol->value;
+      char **items = arena_alloc(&arena, array->count * sizeof(char *));
+      int i;
+      items[0] = value;
+      for (i = 1; i < array->count; i++) {
+        items[i] = arena_strndup(&arena, array->items[i], strlen(array->items[i]));
       }
-      perror(argv[0]);
-      /*
-       * The child must exit here if the exec failed, otherwise we would
-       * have another shell running
-       */
-      exit(errno);
+      symtab = symtab_set_array(symtab, assign->name, array->count, items);
     } else {
-      int stat_loc;
-      pid = waitpid(pid, &stat_loc, 0);
-      if (pid != -1 ) {
-        // Get the child exit code
-        rc = WEXITSTATUS(stat_loc);
-      }
+      symtab = symtab_set(symtab, assign->name, SYM_VAR, value);
     }
+  } else {
+    symtab = symtab_set(symtab, assign->name, SYM_VAR, assign->value);
+  }
+}
+
+/*
+ * What a setting in front of an internal command or function replaced,
+ * to be put back once it has run
+ */
+typedef struct {
+  int set;                      // The name had a symbol
+  stype_t type;
+  int exported;
+  char *value;                  // Of a SYM_VAR, NULL if it has none yet
+  int64_t number;               // Of a SYM_INT
+  int count;                    // Of a SYM_ARRAY
+  char **items;
+} saved_t;
+
+/*
+ * Make the settings in front of an internal command or function for it
+ * alone, and exported as they would be to an external command. Returns
+ * what they replaced, for restore()
+ */
+static saved_t *
+temporary(command_t *command)
+{
+  saved_t *saved = arena_calloc(&arena, command->nassigns, sizeof(saved_t));
+  array_t *array;
+  int i, j;
 
-    return rc;
+  for (i = 0; i < command->nassigns; i++) {
+    assign_t *assign = &command->assigns[i];
+    symbol_t *symbol = symtab_lookup(symtab, assign->name);
+    saved_t *s = &saved[i];
+
+    if (symbol) {
+      s->set = 1;
+      s->type = symbol->type;
+      s->exported = symbol->exported;
+      switch (symbol->type) {
+      case SYM_VAR:
+        // It may have been exported before it was given a value
+        if (symbol->value) {
+          s->value = arena_strndup(&arena, symbol->value, strlen(symbol->value));
+        }
+        break;
+      case SYM_INT:
+        s->number = symbol->number;
+        break;
+      case SYM_ARRAY:
+        array = symbol->value;
+        s->count = array->count;
+        s->items = arena_alloc(&arena, array->count * sizeof(char *));
+        for (j = 0; j < array->count; j++) {
+          s->items[j] = arena_strndup(&arena, array->items[j], strlen(array->items[j]));
+        }
+        break;
+      default:
+        // A command of that name, which no setting may replace
+        continue;
+      }
+    }
+    setting(assign);
+    symtab = symtab_export(symtab, assign->name, 1);
+  }
+  return saved;
 }
-#endif /* LSH_ENABLE_EXTERNAL */
 
 /*
- * Run an internal or external command
+ * Put back what temporary() replaced. It goes backwards so that a name
+ * set twice gets back what it had before the first
  */
+static void
+restore(command_t *command, saved_t *saved)
+{
+  int i;
+
+  for (i = command->nassigns - 1; i >= 0; i--) {
+    char *name = command->assigns[i].name;
+    saved_t *s = &saved[i];
+
+    if (!s->set || (s->type == SYM_VAR && !s->value)) {
+      symtab = symtab_remove(symtab, name);
+      // Exported with no value, it still is
+      if (s->set && s->exported) {
+        symtab = symtab_export(symtab, name, 1);
+      }
+      continue;
+    }
+    switch (s->type) {
+    case SYM_VAR:
+      symtab = symtab_set(symtab, name, SYM_VAR, s->value);
+      break;
+    case SYM_INT:
+      symtab = symtab_set_int(symtab, name, s->number);
+      break;
+    case SYM_ARRAY:
+      symtab = symtab_set_array(symtab, name, s->count, s->items);
+      break;
+    default:
+      continue;
+    }
+    symtab = symtab_export(symtab, name, s->exported);
+  }
+}
+
 static int
-dispatch(void)
+internal(resolved_t *r, int fds[3], command_t *command)
 {
+  int argc = command->argc;
+  char **argv = command->argv;
   int status = -1;
- 
-  if (*cmd) {
+
+  if (r && r->type == R_INTERNAL) {
+    int saved[3];
+    saved_t *settings = temporary(command);
+    execute_redirect(fds, saved);
+    PHASE(P_BUILTIN);
+    status = r->internal(argc, argv);
+    execute_restore(saved);
+    restore(command, settings);
+#ifdef LSH_ENABLE_FUNCS
+  } else if (r && r->type == R_FUNCTION) {
+    int saved[3];
+    saved_t *settings = temporary(command);
+    execute_redirect(fds, saved);
+    status = call(r->func, argc, argv);
+    execute_restore(saved);
+    restore(command, settings);
+#endif
+  } else {
+#if !defined(LSH_ENABLE_EXTERNAL)
+    lsh_not_impl(argv[0]);
+#endif
+  }
+  return status;
+}
+
+#ifdef LSH_ENABLE_EXTERNAL
+#ifdef LSH_ENABLE_ENV
+/*
+ * The environment for an external command with settings in front of
+ * it, which are added to the exported variables. The symbol table, and
+ * so the environment kept for every other command, is left alone
+ */
+static char **
+prefixed(command_t *command)
+{
+  char **vars = arena_alloc(&arena, command->nassigns * sizeof(char *));
+  int i, j, n = 0;
+
+  for (i = 0; i < command->nassigns; i++) {
+    assign_t *assign = &command->assigns[i];
+    size_t len = strlen(assign->name);
+    const char *old = NULL;
+
+    if (assign->items) {
+      // Arrays are not passed on
+      continue;
+    }
+    if (assign->append) {
+      symbol_t *symbol = symtab_lookup(symtab, assign->name);
+      old = symbol ? symtab_string(symbol) : NULL;
+      // Unless a setting before this one has already changed it
+      for (j = n - 1; j >= 0; j--) {
+        if (strncmp(vars[j], assign->name, len) == 0 && vars[j][len] == '=') {
+          old = &vars[j][len + 1];
+          break;
+        }
+      }
+    }
+    if (!old) {
+      old = "";
+    }
+    vars[n] = arena_alloc(&arena, len + strlen(old) + strlen(assign->value) + 2);
+    sprintf(vars[n++], "%s=%s%s", assign->name, old, assign->value);
+  }
+  return env_merge(&arena, env_envp(), vars, n);
+}
+#endif /* LSH_ENABLE_ENV */
+
+/*
+ * Start an external command in process group pgid and return its pid,
+ * or -1 having reported why it could not be started
+ */
+static pid_t
+launch(resolved_t *r, int fds[3], command_t *command, pid_t pgid)
+{
+  char **argv = command->argv;
+  const char *path;
+  struct stat st;
+  pid_t pid;
+#ifdef LSH_ENABLE_ENV
+  // Built again only if an exported variable has changed
+  char **envp = command->nassigns ? prefixed(command) : env_envp();
+#else
+  extern char **environ;
+  char **envp = environ;
+#endif
+  spawn_t method = execute_method(symtab_fetch(symtab, "LSH_SPAWN", LSH_SPAWN));
+
+  /*
+   * If argc[0] contains no '/' character then it must have been
+   * found on the PATH by the resolver. Otherwise we can just
+   * call exec
+   */
+  if (index(argv[0], '/') == NULL) {
+    path = r ? r->path : NULL;
+  } else {
+    path = argv[0];
+    r = NULL;
+  }
+  errno = ENOENT;
+  PHASE(P_SPAWN);
+  pid = path ? execute_spawn(method, path, argv, envp, fds, pgid) : -1;
+  if (pid < 0 && errno == ENOENT && r && stat(r->path, &st) < 0) {
     /*
-     * Build the argument vector argv
+     * The binary we remembered has gone away since we hashed it
+     * so look for it on the PATH again, but only the once: a
+     * script whose interpreter is missing fails with ENOENT too
      */
-    int argc;
-    token_t **tokens = tokenise_fetch(cmd, &argc);
-    char **argv = calloc(argc + 1, sizeof(char *));
-    int i;
-    for (i = 0; i < argc; i++) {
-      argv[i] = strdup(tokens[i]->value);
+    hash_forget(argv[0]);
+    r = hash_resolve(argv[0]);
+    path = r ? r->path : NULL;
+    errno = ENOENT;
+    pid = path ? execute_spawn(method, path, argv, envp, fds, pgid) : -1;
+  }
+  if (pid < 0) {
+    /*
+     * Report the failure the same way whichever way we tried to
+     * start it
+     */
+    int error = errno;
+    perror(argv[0]);
+    errno = error;
+  }
+  return pid;
+}
+
+/*
+ * With job control the command has a process group, and the terminal,
+ * of its own like any pipeline, so that a ^Z stops it and not us
+ */
+static int
+external(resolved_t *r, int fds[3], command_t *command, struct rusage *usage)
+{
+  pid_t pgid = execute_group();
+  pid_t pid = launch(r, fds, command, pgid);
+  int status;
+
+  PHASE(P_WAIT);
+  // As with sh, a command that never started is 127 if it was not found
+  if (pid < 0) {
+    return errno == ENOENT ? 127 : 126;
+  }
+  if (pgid == 0) {
+    execute_foreground(pid);
+  }
+#ifdef LSH_ENABLE_JOBS
+  int stopped = 0;
+  status = execute_wait(pid, pgid == 0 ? &stopped : NULL, usage);
+#else
+  status = execute_wait(pid, NULL, usage);
+#endif
+  if (pgid == 0) {
+    execute_foreground(getpgrp());
+  }
+#ifdef LSH_ENABLE_JOBS
+  if (stopped) {
+    pipeline_t pipeline = { command, 1 };
+    return job_stopped(pid, &pid, 1, &pipeline, pid);
+  }
+#endif
+  return status;
+}
+#endif /* LSH_ENABLE_EXTERNAL */
+
+/*
+ * Run an internal or external command
+ */
+static int
+dispatch(command_t *command)
+{
+  int status = 0;
+  int fds[3] = { -1, -1, -1 };
+  int i;
+
+  PHASE(P_RESOLVE);
+#ifdef LSH_ENABLE_USERVARS
+  if (command->expand && expand_command(&arena, command) < 0) {
+    return 1;
+  }
+#endif
+  /*
+   * Settings on a line of their own last. Those in front of a command
+   * are for that command alone
+   */
+  if (command->argc == 0) {
+    for (i = 0; i < command->nassigns; i++) {
+      setting(&command->assigns[i]);
     }
-    argv[argc] = NULL;
+  }
+  if (execute_open(command, fds) < 0) {
+    return 1;
+  }
+
+  if (command->argc > 0) {
+    char **argv = command->argv;
+    struct rusage usage, *waited = NULL;
+#ifdef LSH_ENABLE_STATS
+    int64_t start = stats_now();
+#endif
+#ifdef LSH_ENABLE_TRACE
+    uint64_t traced = tracing ? trace_now() : 0;
+#endif
+    // Find out what this command is, usually from the hash
+    resolved_t *r = hash_resolve(argv[0]);
     // See if there is an internal command of this name and run that
-    status = internal(argc, argv);
+    status = internal(r, fds, command);
 #ifdef LSH_ENABLE_EXTERNAL
     /*
      * If an internal command of that name does not exist then see if
      * we could run an external command of the same name
      */ 
     if (status < 0) {
-      status = external(argc, argv);
+      memset(&usage, 0, sizeof(usage));
+      waited = &usage;
+      status = external(r, fds, command, waited);
     }
 #endif /* LSH_ENABLE_EXTERNAL */
-    for (i = 0; i < argc; i++) {
-      free(argv[i]);
+#ifdef LSH_ENABLE_STATS
+    stats_record(argv[0], stats_now() - start, waited);
+#else
+    (void)waited;
+#endif
+#ifdef LSH_ENABLE_TRACE
+    if (traced) {
+      trace_command(argv[0], 0, traced);
     }
-    free(argv);
+#endif
   }
+  execute_close(fds);
 
   return status;
 }
 
+#ifdef LSH_ENABLE_PIPES
 /*
- * Check for the valid forms of command input which are:
+ * Start one stage of a pipeline in process group pgid. Internal
+ * commands get a forked copy of the shell to run in, which must not
+ * hold on to spare, the read end of the next pipe. Returns the pid
+ * or -1 if the stage could not be started
+ */
+pid_t
+lsh_stage(command_t *command, int fds[3], pid_t pgid, int spare)
+{
+  resolved_t *r = NULL;
+  pid_t pid;
+
+  PHASE(P_RESOLVE);
+#ifdef LSH_ENABLE_USERVARS
+  if (command->expand && expand_command(&arena, command) < 0) {
+    return -1;
+  }
+#endif
+  if (command->argc > 0) {
+    r = hash_resolve(command->argv[0]);
+#ifdef LSH_ENABLE_EXTERNAL
+    if (!r || r->type == R_EXTERNAL) {
+      return launch(r, fds, command, pgid);
+    }
+#endif
+  }
+
+  PHASE(P_SPAWN);
+  pid = execute_fork(pgid, fds);
+  if (pid == 0) {
+    int status = 0;
+    if (spare >= 0) {
+      close(spare);
+    }
+    // Only this copy of the shell sees the settings in front of it
+    temporary(command);
+    if (r && r->type == R_INTERNAL) {
+      status = r->internal(command->argc, command->argv);
+#ifdef LSH_ENABLE_FUNCS
+    } else if (r && r->type == R_FUNCTION) {
+      status = call(r->func, command->argc, command->argv);
+#endif
+    } else if (command->argc > 0) {
+      lsh_not_impl(command->argv[0]);
+      status = 127;
+    }
+    fflush(stdout);
+    _exit(status);
+  } else if (pid < 0) {
+    perror("fork");
+  }
+  return pid;
+}
+
+/*
+ * Run <command> | <command> [| <command> ...] [&]
  *
- * <command> [<arg1> <arg2> ... <argN>]
- * <name>=<value>
+ * Every stage is started, back to back, as a direct child of the shell
+ * in the one process group and only then are they all waited for. A
+ * stage's own redirections take the place of its pipe ends. The exit
+ * code is that of the last stage. Pipe buffers are LSH_PIPESIZE bytes
+ * if that is set. A background pipeline is not waited for but added
+ * to the job table, and without job control to keep it off the
+ * terminal it reads from /dev/null. With job control, a foreground
+ * pipeline that is stopped becomes a job then
  */
 static int
-parse(void)
+pipeline_run(pipeline_t *pipeline)
 {
-  TRIM(cmd);
+  int status = 0;
+  int size = atoi(symtab_fetch(symtab, "LSH_PIPESIZE", "0"));
+  pid_t *pids = arena_alloc(&arena, pipeline->stages * sizeof(pid_t));
+  pid_t pgid = execute_group();
+  int in = -1;            // Read end of the pipe from the previous stage
+  command_t *command;
+  int i, n = 0;
+#ifdef LSH_ENABLE_STATS
+  int64_t start = stats_now();
+#endif
+#ifdef LSH_ENABLE_TRACE
+  uint64_t traced = tracing ? trace_now() : 0;
+#endif
 
-#ifdef LSH_ENABLE_USERVARS
-  regex_t regex;
-  const int cflags = REG_EXTENDED|REG_NEWLINE;
-  int rc;
-  regmatch_t pmatch[4];
-
-  // Look for patterns of the form: <name>=<value>
-  (void)regcomp(&regex, "([a-zA-Z]+[a-zA-Z0-9]*)=(.*)", cflags);
-  rc = regexec(&regex, cmd, SZ(pmatch), pmatch, 0);
-  if (rc == 0) {
-    int count = 0;
-    token_t **tokens = tokenise_fetch(cmd, &count);
-    symtab = symtab_set(symtab, tokens[0]->value, SYM_VAR, tokens[2]->value);
-    tokenise_free(tokens, count);
+  for (command = pipeline->commands; command; command = command->next) {
+    int fds[3] = { -1, -1, -1 };
+    int p[2] = { -1, -1 };
+    pid_t pid = -1;
+
+    if (command->next && execute_pipe(p, size) < 0) {
+      perror("pipe");
+      break;
+    }
+    if (execute_open(command, fds) == 0) {
+      if (fds[STDIN_FILENO] < 0 && in < 0 && pipeline->background && pgid < 0) {
+        in = open("/dev/null", O_RDONLY | O_CLOEXEC);
+      }
+      if (fds[STDIN_FILENO] < 0) {
+        fds[STDIN_FILENO] = in;
+        in = -1;
+      }
+      if (fds[STDOUT_FILENO] < 0) {
+        fds[STDOUT_FILENO] = p[1];
+        p[1] = -1;
+      }
+      pid = lsh_stage(command, fds, pgid, p[0]);
+      execute_close(fds);
+    }
+    // Whatever ends were not handed to the stage are no use now
+    if (in >= 0) {
+      close(in);
+    }
+    if (p[1] >= 0) {
+      close(p[1]);
+    }
+    in = p[0];
+
+    if (pid > 0 && pgid == 0) {
+      // The first stage to start leads the group
+      pgid = pid;
+      if (!pipeline->background) {
+        execute_foreground(pgid);
+      }
+    }
+    // Only the last stage decides the exit code
+    status = pid < 0 ? 1 : 0;
+    pids[n++] = pid;
+  }
+  if (in >= 0) {
+    close(in);
+  }
+#ifdef LSH_ENABLE_JOBS
+  if (pipeline->background) {
+    return job_add(pgid, pids, n, pipeline) < 0;
+  }
+#endif
+
+  PHASE(P_WAIT);
+  for (i = 0, command = pipeline->commands; i < n; i++, command = command->next) {
+    if (pids[i] > 0) {
+      struct rusage usage;
+#ifdef LSH_ENABLE_JOBS
+      int stopped = 0;
+      int rc = execute_wait(pids[i], pgid > 0 ? &stopped : NULL, &usage);
+      if (stopped) {
+        // Those before it have all been waited for
+        execute_foreground(getpgrp());
+        return job_stopped(pgid, &pids[i], n - i, pipeline, pids[i]);
+      }
+#else
+      int rc = execute_wait(pids[i], NULL, &usage);
+#endif
+#ifdef LSH_ENABLE_STATS
+      // Each stage is charged from when the pipeline started
+      if (command->argc > 0) {
+        stats_record(command->argv[0], stats_now() - start, &usage);
+      }
+#endif
+#ifdef LSH_ENABLE_TRACE
+      if (traced && command->argc > 0) {
+        trace_command(command->argv[0], pids[i], traced);
+      }
+#endif
+      if (i == n - 1) {
+        status = rc;
+      }
+    }
+  }
+  if (pgid > 0) {
+    execute_foreground(getpgrp());
+  }
+
+  return status;
+}
+#endif /* LSH_ENABLE_PIPES */
+
+#ifdef LSH_ENABLE_JOBS
+// A background command is run as a job even if it is not a pipeline
+#define BACKGROUND(p)   ((p)->background)
+#else
+#define BACKGROUND(p)   0
+#endif
+
+/*
+ * Run a parsed pipeline, or single command, and return its exit code
+ */
+int
+lsh_execute(pipeline_t *pipeline)
+{
+  int status = 0;
+
+  if (pipeline->keyword != K_NONE) {
+    // Compound commands can only be read a line at a time
+    fprintf(stderr, "syntax error near unexpected token '%s'\n",
+            parse_keyword(pipeline->keyword));
+    return 2;
+  }
+  if (pipeline->stages > 1 || BACKGROUND(pipeline)) {
+#ifdef LSH_ENABLE_PIPES
+    status = pipeline_run(pipeline);
+#else
+    lsh_not_impl("|");
+#endif
   } else {
-    /*
-     * Not a variable setting so assume it's a command
-     */
+    status = dispatch(pipeline->commands);
+  }
+  return status;
+}
+
+/*
+ * Run a line that has been parsed, if it could be and is not part of
+ * a function or compound command being read, or the compound command
+ * it ends, and clear up after it ready for the next
+ */
+static int
+finish(pipeline_t *pipeline)
+{
+  int status = 0;
+
+  if (!pipeline) {
+    // It had a syntax error, which has been reported
+    status = 2;
+#ifdef LSH_ENABLE_USERVARS
+    symtab = symtab_set_int(symtab, "?", status);
 #endif
-    dispatch();
+  }
+#ifdef LSH_ENABLE_FUNCS
+  func_t *ready;
+  if (pipeline && func_collect(pipeline, &ready)) {
+    pipeline = NULL;
+    if (ready) {
+      status = block(ready, 0, ready->lines);
+      func_release(ready);
+    }
+  }
+#endif
+  if (pipeline) {
+    status = lsh_execute(pipeline);
 #ifdef LSH_ENABLE_USERVARS
+    symtab = symtab_set_int(symtab, "?", status);
+#endif
+  }
+
+  arena_reset(&arena);
+#ifdef LSH_ENABLE_JOBS
+  if (!interactive) {
+    job_reap();
   }
 #endif
+  PHASE_LINE();
+
+  return status;
+}
+
+/*
+ * Check for the valid forms of command input which are:
+ *
+ * [<name>=<value> ...] [<command> [<arg1> <arg2> ... <argN>]] [< <file>] [> <file>]
+ *
+ * The first len bytes of line are tokenised and parsed once into a
+ * pipeline which is run from then on without looking at the text
+ * again. The byte at line[len] may be overwritten. Lines starting
+ * with a '#' are comments, which lets scripts start with #!
+ */
+static int
+run(char *line, size_t len)
+{
+  while (len > 0 && isspace((unsigned char)*line)) {
+    line++;
+    len--;
+  }
+  if (len == 0 || *line == '#') {
+    return 0;
+  }
+
+  return finish(parse_line(&arena, line, len));
+}
 
+static int
+parse(void)
+{
+  int status;
+
+  TRIM(cmd);
+  status = run(cmd, strlen(cmd));
   RESET(cmd);
 
-  // FIXME
-  return 0;
+  return status;
 }
 
 static int repl(void)
@@ -335,21 +1097,197 @@ static int repl(void)
 
   for (prompt(); READ(cmd) != NULL; prompt()) {
     status = parse();
+  }
+  if (interactive) fprintf(stdout, "\n");
+
+  return status;
+}
+
+/*
+ * Run each line of the first len bytes of text where it lies. Every
+ * line must be followed by a writable byte, its newline will do
+ */
+static int
+batch(char *text, size_t len)
+{
+  int status = 0;
+  char *end = text + len;
+
+  while (text < end) {
+    char *nl = memchr(text, '\n', end - text);
+    if (!nl) {
+      nl = end;
+    }
+    status = run(text, nl - text);
+    text = nl + 1;
+  }
+  return status;
+}
+
+#ifdef LSH_ENABLE_CACHE
+/*
+ * Run a script from its cache, which has the pipelines already parsed
+ * and has been checked through as it was loaded
+ */
+static int
+replay(cache_t *cache)
+{
+  int status = 0;
+  pipeline_t *pipeline;
+  char *line;
+  size_t len;
+
+  for (;;) {
+    PHASE(P_PARSE);
+    if (cache_next(cache, &arena, &pipeline, &line, &len) <= 0) {
+      break;
+    }
+    status = pipeline ? finish(pipeline) : run(line, len);
+  }
+  return status;
+}
+#endif /* LSH_ENABLE_CACHE */
+
+/*
+ * Run a script file. It is mapped rather than read so lines are
+ * parsed straight out of the page cache with no copy into the buffer.
+ * The mapping is private so parsing in place never touches the file
+ */
+static int
+script(const char *file)
+{
+  int status = 0;
+  struct stat st;
+  int fd = open(file, O_RDONLY | O_CLOEXEC);
+#ifdef LSH_ENABLE_CACHE
+  int cached;
+#endif
+
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    perror(file);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return 127;
+  }
+
+#ifdef LSH_ENABLE_CACHE
+  // Unless LSH_CACHE=off the script is only parsed when it changes
+  if ((cached = strcmp(symtab_fetch(symtab, "LSH_CACHE", "on"), "off") != 0)) {
+    cache_t *cache = cache_load(file, &st);
+    if (cache) {
+      close(fd);
+      status = replay(cache);
+      cache_free(cache);
+      return status;
+    }
+  }
+#endif
 
-    // TODO Bind to the exit code of the command just run to $?
+  if (st.st_size > 0) {
+    size_t size = st.st_size, last;
+    char *text = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (text == MAP_FAILED) {
+      perror(file);
+      close(fd);
+      return 127;
+    }
+    (void)madvise(text, size, MADV_SEQUENTIAL);
+#ifdef LSH_ENABLE_CACHE
+    if (cached) {
+      cache_save(file, &st, text, size);
+    }
+#endif
+
+    /*
+     * Nothing follows an unterminated last line that we could write
+     * to so that one line alone is copied out, however long it is
+     */
+    for (last = size; last > 0 && text[last - 1] != '\n'; last--)
+      ;
+    status = batch(text, last);
+    if (last < size) {
+      char *line = malloc(size - last + 1);
+      memcpy(line, &text[last], size - last);
+      status = run(line, size - last);
+      free(line);
+    }
+    munmap(text, size);
   }
-  if (isatty(STDOUT_FILENO)) fprintf(stdout, "\n");
+  close(fd);
 
   return status;
 }
 
+static void usage(void)
+{
+  fprintf(stderr, "usage: %s [-c command [name [arg ...]] | script [arg ...]]\n",
+          progname);
+  exit(2);
+}
 
 int main(int argc, char *argv[]) 
 {
+  int status;
+
+#ifdef LSH_ENABLE_ZYGOTE
+  /*
+   * Before anything else has been allocated, so the method has to come
+   * straight from the environment. Setting LSH_SPAWN=zygote later finds
+   * no server and spawns some other way
+   */
+  zygote_init(execute_method(getenv("LSH_SPAWN") ? getenv("LSH_SPAWN")
+                             : LSH_SPAWN) == SPAWN_ZYGOTE);
+#endif
   progname = strdup(basename(argv[0]));
   init();
-  license();
-  repl();
+#ifdef LSH_ENABLE_PHASES
+  phase_init();
+#endif
+#ifdef LSH_ENABLE_TRACE
+  trace_init();
+#endif
+  // Only a shell reading commands from its input talks to anyone
+  interactive = argc == 1 && isatty(STDOUT_FILENO);
+#ifdef LSH_ENABLE_JOBS
+  job_init(interactive);
+#endif
+
+  if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+    // The argument is ours to write over, including its terminator
+    if (argc < 3) {
+      usage();
+    }
+#ifdef LSH_ENABLE_FUNCS
+    // As with sh -c, any words after the command are $0, $1, ...
+    func_push(argc > 3 ? argc - 3 : 1, argc > 3 ? &argv[3] : argv);
+#endif
+    status = batch(argv[2], strlen(argv[2]));
+  } else if (argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0') {
+    usage();
+  } else if (argc > 1) {
+#ifdef LSH_ENABLE_FUNCS
+    func_push(argc - 1, &argv[1]);
+#endif
+    status = script(argv[1]);
+  } else {
+#ifdef LSH_ENABLE_FUNCS
+    func_push(1, argv);
+#endif
+    execute_init(interactive);
+    license();
+    repl();
+#ifdef LSH_ENABLE_FUNCS
+    func_pending(1);
+#endif
+    exiting();
+    exit(0);
+  }
+#ifdef LSH_ENABLE_FUNCS
+  if (func_pending(1)) {
+    status = 2;
+  }
+#endif
   exiting();
-  exit(0);
+  exit(status);
 }
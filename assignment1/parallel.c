@@ -0,0 +1,372 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * Run command lines side by side (the 'parallel' internal command)
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/signalfd.h>
+
+#include "arena.h"
+#include "symtab.h"
+#include "parse.h"
+#include "execute.h"
+#include "expand.h"
+#include "parallel.h"
+#include "lsh.h"
+
+#ifdef LSH_ENABLE_PARALLEL
+
+/*
+ * Each line is parsed and resolved just as the shell would run it, and
+ * started in a free slot. A single command is started directly, with
+ * no shell in between, while a pipeline gets a forked copy of the
+ * shell to run it. Children are noticed as they exit through a
+ * signalfd, which is polled alongside the pipes their output is being
+ * collected from when it is grouped. Needs LSH_ENABLE_PIPES for
+ * lsh_stage()
+ */
+typedef struct {
+  pid_t pid;                    // 0 if the slot is free, -1 once reaped
+  int out;                      // Where its output is collected from, or -1
+  char *text;                   // What has been collected
+  size_t len;
+  size_t size;
+  int status;
+  int index;                    // Of the job in the input
+} slot_t;
+
+// The exit code of every job, in input order, is left here
+#define STATUS_NAME "PARALLEL_STATUS"
+
+// Like xargs, a job that could not be run at all is "not found"
+#define NOT_RUN 127
+
+static int
+usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-g] [-j jobs] [file]\n", name);
+  return 2;
+}
+
+/*
+ * Start the job on the first len bytes of line in slot. Its standard
+ * input is /dev/null, so that it does not eat the lines still to come,
+ * and its output goes down a pipe to us if it is to be grouped
+ */
+static int
+start(slot_t *slot, arena_t *arena, char *line, size_t len, int group)
+{
+  pipeline_t *pipeline = parse_line(arena, line, len);
+  int fds[3] = { -1, -1, -1 };
+  int p[2] = { -1, -1 };
+  pid_t pid = -1;
+
+  if (!pipeline) {
+    return -1;
+  }
+  if (group && execute_pipe(p, 0) < 0) {
+    perror("pipe");
+    return -1;
+  }
+  slot->out = p[0];
+  slot->len = 0;
+
+  if (pipeline->stages == 1 && !pipeline->background) {
+    command_t *command = pipeline->commands;
+#ifdef LSH_ENABLE_USERVARS
+    // Expanded here so that nothing is left behind in the shell's arena
+    if (command->expand) {
+      if (expand_command(arena, command) < 0) {
+        goto fail;
+      }
+      command->expand = 0;
+    }
+#endif
+    if (execute_open(command, fds) < 0) {
+      goto fail;
+    }
+    if (fds[STDIN_FILENO] < 0) {
+      fds[STDIN_FILENO] = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+    if (fds[STDOUT_FILENO] < 0) {
+      fds[STDOUT_FILENO] = p[1];
+      p[1] = -1;
+    }
+    pid = lsh_stage(command, fds, -1, p[0]);
+    execute_close(fds);
+  } else {
+    fds[STDIN_FILENO] = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    fds[STDOUT_FILENO] = p[1];
+    p[1] = -1;
+    pid = execute_fork(-1, fds);
+    if (pid == 0) {
+      int status;
+      if (p[0] >= 0) {
+        close(p[0]);
+      }
+      // Many of these at once can't all have the terminal
+      execute_init(0);
+      status = lsh_execute(pipeline);
+      fflush(stdout);
+      _exit(status);
+    } else if (pid < 0) {
+      perror("fork");
+    }
+    execute_close(fds);
+  }
+
+fail:
+  if (p[1] >= 0) {
+    close(p[1]);
+  }
+  if (pid <= 0) {
+    if (p[0] >= 0) {
+      close(p[0]);
+    }
+    slot->out = -1;
+    return -1;
+  }
+  slot->pid = pid;
+  return 0;
+}
+
+/*
+ * Read what is waiting from a job's output pipe
+ */
+static void
+collect(slot_t *slot)
+{
+  ssize_t n;
+
+  if (slot->size - slot->len < 4096) {
+    slot->size = slot->size ? slot->size * 2 : 8192;
+    slot->text = realloc(slot->text, slot->size);
+  }
+  n = read(slot->out, &slot->text[slot->len], slot->size - slot->len);
+  if (n > 0) {
+    slot->len += n;
+  } else if (n == 0 || errno != EINTR) {
+    close(slot->out);
+    slot->out = -1;
+  }
+}
+
+/*
+ * Reap whichever of our children have exited
+ */
+static void
+reap(slot_t *slots, int n)
+{
+  int i, st;
+
+  for (i = 0; i < n; i++) {
+    if (slots[i].pid > 0 && waitpid(slots[i].pid, &st, WNOHANG) > 0) {
+      slots[i].status = WIFEXITED(st) ? WEXITSTATUS(st) : 128 + WTERMSIG(st);
+      slots[i].pid = -1;
+    }
+  }
+}
+
+/*
+ * Leave the exit codes of the n jobs in the shell's array
+ */
+static void
+report(int *codes, int n)
+{
+  char **items = malloc((n + 1) * sizeof(char *));
+  char *text = malloc(n * 4 + 1);
+  char *t = text;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    items[i] = t;
+    t += sprintf(t, "%d", codes[i]) + 1;
+  }
+  items[n] = NULL;
+  symtab = symtab_set_array(symtab, STATUS_NAME, n, items);
+  free(items);
+  free(text);
+}
+
+/*
+ * parallel [-g] [-j jobs] [file]
+ *
+ * Run each line of the file, or of standard input, as a command with
+ * up to jobs of them running at once, by default one for each CPU.
+ * With -g each job's output is held back until it finishes and then
+ * written out whole, so that the output of different jobs is never
+ * mixed. Blank lines and comments are skipped. The exit code of every
+ * job is left in the PARALLEL_STATUS array and the exit code is the
+ * number of jobs that failed, up to 101
+ */
+int
+lsh_parallel(int argc, char **argv)
+{
+  int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  int group = 0, running = 0, failed = 0, eof = 0;
+  int *codes = NULL, ncodes = 0, size = 0;
+  int i, sigfd, opt;
+  FILE *in = stdin;
+  char *line = NULL;
+  size_t room = 0;
+  slot_t *slots;
+  struct pollfd *fds;
+  arena_t arena = { 0 };
+  sigset_t set, saved;
+
+  optind = 0;
+  while ((opt = getopt(argc, argv, "+gj:")) != -1) {
+    switch (opt) {
+    case 'g':
+      group = 1;
+      break;
+    case 'j':
+      jobs = atoi(optarg);
+      if (jobs < 1) {
+        return usage(argv[0]);
+      }
+      break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+  if (argc - optind > 1) {
+    return usage(argv[0]);
+  }
+  if (optind < argc && !(in = fopen(argv[optind], "r"))) {
+    perror(argv[optind]);
+    return 1;
+  }
+  if (jobs < 1) {
+    jobs = 1;
+  }
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &set, &saved);
+  sigfd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+  slots = calloc(jobs, sizeof(slot_t));
+  fds = malloc((jobs + 1) * sizeof(struct pollfd));
+  for (i = 0; i < jobs; i++) {
+    slots[i].out = -1;
+  }
+
+  for (;;) {
+    // Keep every slot busy while there are lines left
+    for (i = 0; i < jobs && !eof; i++) {
+      ssize_t len;
+      char *s;
+
+      while (!slots[i].pid && (len = getline(&line, &room, in)) >= 0) {
+        for (s = line; *s == ' ' || *s == '\t'; s++)
+          ;
+        if (*s == '\n' || *s == '#' || *s == '\0') {
+          continue;
+        }
+        if (ncodes == size) {
+          size = size ? size * 2 : 64;
+          codes = realloc(codes, size * sizeof(int));
+        }
+        slots[i].index = ncodes;
+        codes[ncodes++] = NOT_RUN;
+        if (start(&slots[i], &arena, line, len, group) == 0) {
+          running++;
+        } else {
+          failed++;
+        }
+        arena_reset(&arena);
+      }
+      eof = !slots[i].pid;
+    }
+    if (running == 0) {
+      break;
+    }
+
+    int n = 0;
+    fds[n].fd = sigfd;
+    fds[n++].events = POLLIN;
+    for (i = 0; i < jobs; i++) {
+      if (slots[i].out >= 0) {
+        fds[n].fd = slots[i].out;
+        fds[n++].events = POLLIN;
+      }
+    }
+    if (poll(fds, n, -1) < 0 && errno != EINTR) {
+      perror("poll");
+      break;
+    }
+    if (fds[0].revents) {
+      struct signalfd_siginfo info;
+      while (read(sigfd, &info, sizeof(info)) > 0)
+        ;
+      reap(slots, jobs);
+    }
+    for (n = 1, i = 0; i < jobs; i++) {
+      if (slots[i].out >= 0 && fds[n++].revents) {
+        collect(&slots[i]);
+      }
+    }
+
+    // A job is done once it has exited and all its output is in
+    for (i = 0; i < jobs; i++) {
+      slot_t *slot = &slots[i];
+      if (slot->pid == -1 && slot->out < 0) {
+        if (slot->len > 0) {
+          fwrite(slot->text, 1, slot->len, stdout);
+          fflush(stdout);
+        }
+        codes[slot->index] = slot->status;
+        failed += slot->status != 0;
+        slot->pid = 0;
+        running--;
+      }
+    }
+  }
+
+  for (i = 0; i < jobs; i++) {
+    free(slots[i].text);
+  }
+  free(slots);
+  free(fds);
+  free(line);
+  arena_free(&arena);
+  if (in == stdin) {
+    clearerr(stdin);
+  } else {
+    fclose(in);
+  }
+  close(sigfd);
+  // Whoever else is waiting on SIGCHLD may have had theirs taken
+  kill(getpid(), SIGCHLD);
+  sigprocmask(SIG_SETMASK, &saved, NULL);
+
+  report(codes, ncodes);
+  free(codes);
+  return failed > 101 ? 101 : failed;
+}
+#endif /* LSH_ENABLE_PARALLEL */
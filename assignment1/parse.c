@@ -0,0 +1,615 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * Parse a line of tokens into a pipeline of commands, ready to run.
+ * Each line is tokenised exactly once and nothing is re-scanned later.
+ * Words are left where they are in the line rather than copied out
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "arena.h"
+#include "tokenise.h"
+#include "parse.h"
+#include "phase.h"
+
+/*
+ * Valid variable names are of the form [a-zA-Z_][a-zA-Z0-9_]*
+ */
+static int
+valid_name(const char *name, size_t len)
+{
+  size_t i;
+
+  if (len == 0 || (!isalpha(*name) && *name != '_')) {
+    return 0;
+  }
+  for (i = 1; i < len; i++) {
+    if (!isalnum(name[i]) && name[i] != '_') {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * The length of the name a setting is for, leaving out the '+' of a
+ * +=, or 0 if it is not a setting at all
+ */
+static size_t
+setting(const char *name, size_t len, int *append)
+{
+  *append = len > 1 && name[len - 1] == '+';
+  len -= *append;
+  return valid_name(name, len) ? len : 0;
+}
+
+/*
+ * The text of special tokens is overwritten when the words around them
+ * are terminated, so name them by type instead
+ */
+static const char *
+special(tview_t *view)
+{
+  switch (view->type) {
+  case T_PIPE:       return "|";
+  case T_BACKGROUND: return "&";
+  case T_FROMFILE:   return "<";
+  case T_TOFILE:     return ">";
+  case T_ASSIGN:     return "=";
+  case T_ENDSTMT:    return ";";
+  default:           return "?";
+  }
+}
+
+#define WORDLIKE(t)   ((t) == T_ARG || (t) == T_ASSIGN)
+#define JOINED(v)     ((v)->flags & V_JOINED)
+
+/*
+ * A word is an argument together with any '=' and arguments that are
+ * joined on to it with no white space. For example --color=auto comes
+ * from the tokeniser as the three tokens '--color', '=' and 'auto'.
+ *
+ * The word is terminated in place and returned as a pointer into the
+ * line. Only if removing quotes or escapes has left gaps between the
+ * pieces of a joined word does it need to be copied. The command is
+ * marked if any piece has something to expand
+ */
+static char *
+word(arena_t *arena, char *line, tview_t *views, int count, int *ip,
+     command_t *command)
+{
+  int first = *ip, last = first, i;
+  int contiguous = 1;
+  size_t len;
+  char *w;
+
+  command->expand |= views[first].flags & V_EXPAND;
+  while (last + 1 < count && WORDLIKE(views[last + 1].type) &&
+         JOINED(&views[last + 1])) {
+    if (views[last].offset + views[last].length != views[last + 1].offset) {
+      contiguous = 0;
+    }
+    last++;
+    command->expand |= views[last].flags & V_EXPAND;
+  }
+  *ip = last;
+
+  if (contiguous) {
+    w = &line[views[first].offset];
+    len = views[last].offset + views[last].length - views[first].offset;
+  } else {
+    for (len = 0, i = first; i <= last; i++) {
+      len += views[i].length;
+    }
+    w = arena_alloc(arena, len + 1);
+    for (len = 0, i = first; i <= last; i++) {
+      memcpy(&w[len], &line[views[i].offset], views[i].length);
+      len += views[i].length;
+    }
+  }
+  w[len] = '\0';
+  return w;
+}
+
+/*
+ * The items of a name=( ... ) from the word at *ip, which starts with
+ * the '(', up to and including the word ending with the ')'. Returns
+ * NULL, leaving *ip at the token that is in the way, if there is no ')'
+ */
+static char **
+items(arena_t *arena, char *line, tview_t *views, int count, int *ip,
+      command_t *command, int *nitems)
+{
+  char **items = arena_alloc(arena, (count - *ip + 1) * sizeof(char *));
+  int n = 0, first = 1;
+
+  for (; *ip < count && WORDLIKE(views[*ip].type); (*ip)++) {
+    int start = *ip, quoted = 0;
+    char *w = word(arena, line, views, count, ip, command);
+    size_t len = strlen(w);
+    int close = views[*ip].flags & V_CLOSE;
+    int stripped = first || close;
+
+    while (start <= *ip) {
+      quoted |= views[start++].flags & V_QUOTED;
+    }
+
+    if (first) {
+      w++;
+      len--;
+      first = 0;
+    }
+    if (close) {
+      w[--len] = '\0';
+    }
+    // A '(' or ')' on its own is not an item, but "" is
+    if (len > 0 || !stripped || quoted) {
+      items[n++] = w;
+    }
+    if (close) {
+      items[n] = NULL;
+      *nitems = n;
+      return items;
+    }
+  }
+  return NULL;
+}
+
+static command_t *
+command_new(arena_t *arena, int count)
+{
+  command_t *command = arena_calloc(arena, 1, sizeof(command_t));
+  // There can't be more words than there are tokens left
+  command->argv = arena_calloc(arena, count + 1, sizeof(char *));
+  return command;
+}
+
+static int
+command_empty(command_t *command)
+{
+  return command->argc == 0 && command->nassigns == 0 &&
+         command->from == NULL && command->to == NULL;
+}
+
+/*
+ * The words that open, divide and close compound commands when they
+ * are the first word of a line. Those with a then take the rest of the
+ * line, parsed as usual, and may end it with a ; and that word instead
+ * of having it on the next line
+ */
+static const struct {
+  const char *word;
+  const char *then;
+} reserved[] = {
+  [K_FUNCTION] = { "{", NULL },
+  [K_CLOSE] =    { "}", NULL },
+  [K_IF] =       { "if", "then" },
+  [K_ELIF] =     { "elif", "then" },
+  [K_THEN] =     { "then", NULL },
+  [K_ELSE] =     { "else", NULL },
+  [K_FI] =       { "fi", NULL },
+  [K_WHILE] =    { "while", "do" },
+  [K_FOR] =      { "for", "do" },
+  [K_DO] =       { "do", NULL },
+  [K_DONE] =     { "done", NULL },
+};
+
+const char *
+parse_keyword(keyword_t keyword)
+{
+  return reserved[keyword].word;
+}
+
+#ifdef LSH_ENABLE_FUNCS
+/*
+ * Whether token i is an unquoted word that nothing is joined on to
+ */
+static int
+bare(tview_t *views, int count, int i)
+{
+  return views[i].type == T_ARG && !(views[i].flags & (V_QUOTED | V_EXPAND)) &&
+         !(i + 1 < count && JOINED(&views[i + 1]));
+}
+
+static int
+is(char *line, tview_t *view, const char *w)
+{
+  return view->length == strlen(w) && memcmp(&line[view->offset], w, view->length) == 0;
+}
+
+/*
+ * The pipeline for a line that starts a function, or NULL if it does
+ * not. A function is started by <name>() { or <name> () { on a line of
+ * its own
+ */
+static pipeline_t *
+function(arena_t *arena, char *line, tview_t *views, int count)
+{
+  pipeline_t *pipeline;
+  command_t *command;
+  char *name = &line[views[0].offset];
+  size_t len = views[0].length;
+
+  if (count < 2 || count > 3 || !bare(views, count, count - 1) ||
+      !is(line, &views[count - 1], "{") || views[0].type != T_ARG ||
+      views[0].flags & (V_QUOTED | V_EXPAND)) {
+    return NULL;
+  }
+  if (count == 2 && len > 2 && memcmp(&name[len - 2], "()", 2) == 0) {
+    len -= 2;
+  } else if (count != 3 || !bare(views, count, 1) || !is(line, &views[1], "()")) {
+    return NULL;
+  }
+  if (!valid_name(name, len)) {
+    return NULL;
+  }
+
+  pipeline = arena_calloc(arena, 1, sizeof(pipeline_t));
+  pipeline->keyword = K_FUNCTION;
+  pipeline->commands = command = command_new(arena, 1);
+  pipeline->stages = 1;
+  name[len] = '\0';
+  command->argv[command->argc++] = name;
+  return pipeline;
+}
+
+/*
+ * The keyword the line starts with, or K_NONE. A ; then or ; do that
+ * ends the line is taken off the count of its tokens and *ready set
+ */
+static keyword_t
+keyword(char *line, tview_t *views, int *count, int *ready)
+{
+  tview_t *last;
+  keyword_t k;
+  int n = *count;
+
+  if (!bare(views, n, 0)) {
+    return K_NONE;
+  }
+  for (k = K_CLOSE; k <= K_DONE && !is(line, &views[0], reserved[k].word); k++)
+    ;
+  if (k > K_DONE) {
+    return K_NONE;
+  }
+  if (reserved[k].then && n > 2 && bare(views, n, n - 1) &&
+      is(line, &views[n - 1], reserved[k].then)) {
+    last = &views[n - 2];
+    if (last->type == T_ARG && last->length > 0 &&
+        line[last->offset + last->length - 1] == ';') {
+      // A ; on its own goes with it
+      *count = --last->length ? n - 1 : n - 2;
+      *ready = 1;
+    }
+  }
+  return k;
+}
+
+/*
+ * for <name> [in <word> ...] is kept as the command <name> <word> ...,
+ * with "$@" as the words if there is no in. Returns the token in the
+ * way if it is not of that form
+ */
+static const char *
+loop_words(arena_t *arena, pipeline_t *pipeline)
+{
+  command_t *command = pipeline->commands;
+  char **argv;
+
+  if (!command || pipeline->stages > 1 || pipeline->background ||
+      command->nassigns || command->from || command->to) {
+    return "for";
+  }
+  if (!valid_name(command->argv[0], strlen(command->argv[0]))) {
+    return command->argv[0];
+  }
+  if (command->argc == 1) {
+#ifdef LSH_ENABLE_USERVARS
+    static char all[] = { CTL_EXPAND, '@', '\0' };
+    argv = arena_alloc(arena, 3 * sizeof(char *));
+    argv[0] = command->argv[0];
+    argv[1] = all;
+    argv[2] = NULL;
+    command->argv = argv;
+    command->argc = 2;
+    command->expand = 1;
+#endif
+  } else if (strcmp(command->argv[1], "in") == 0) {
+    argv = command->argv;
+    memmove(&argv[1], &argv[2], (command->argc - 1) * sizeof(char *));
+    command->argc--;
+  } else {
+    return command->argv[1];
+  }
+  return NULL;
+}
+#endif /* LSH_ENABLE_FUNCS */
+
+/*
+ * Return the pipeline described by the first len bytes of line, or
+ * NULL if the line is empty or has a syntax error, when *error is set
+ * to the token it was found at. The line is modified in place and the
+ * words of the pipeline point into it. Everything else is allocated
+ * from the arena
+ */
+pipeline_t *
+parse_pipeline(arena_t *arena, char *line, size_t len, const char **errorp)
+{
+  int count, i, append;
+  size_t namelen;
+  tview_t *views;
+  pipeline_t *pipeline = NULL;
+  command_t *command = NULL, **tail = NULL;
+  const char *error = NULL;
+  int first = 0;
+#ifdef LSH_ENABLE_FUNCS
+  keyword_t k = K_NONE;
+  int ready = 0;
+#endif
+
+  PHASE(P_TOKENISE);
+  views = tokenise_views(arena, line, len, &count);
+  PHASE(P_PARSE);
+
+  *errorp = NULL;
+#ifdef LSH_ENABLE_FUNCS
+  if (count > 0 && (pipeline = function(arena, line, views, count)) != NULL) {
+    return pipeline;
+  }
+  if (count > 0 && (k = keyword(line, views, &count, &ready)) != K_NONE) {
+    // The rest of the line is parsed as the keyword's own command
+    first = 1;
+    if (!reserved[k].then != (count == 1)) {
+      *errorp = count == 1 ? "newline" : reserved[k].word;
+      return NULL;
+    }
+  }
+#endif
+
+  if (count > 0) {
+    pipeline = arena_calloc(arena, 1, sizeof(pipeline_t));
+    tail = &pipeline->commands;
+  }
+
+  for (i = first; i < count && !error; i++) {
+    tview_t *view = &views[i];
+    ttype_t type = view->type;
+
+    if (!command) {
+      command = command_new(arena, count - i);
+      *tail = command;
+      tail = &command->next;
+      pipeline->stages++;
+    }
+
+    switch (type) {
+    case T_ARG:
+      /*
+       * Leading <name>=<value> pairs are settings, anything after
+       * the command name is just an argument
+       */
+      if (command->argc == 0 && i + 1 < count &&
+          views[i + 1].type == T_ASSIGN && JOINED(&views[i + 1]) &&
+          (namelen = setting(&line[view->offset], view->length, &append)) > 0) {
+        if (!command->assigns) {
+          command->assigns = arena_calloc(arena, count - i, sizeof(assign_t));
+        }
+        assign_t *assign = &command->assigns[command->nassigns++];
+        assign->name = &line[view->offset];
+        assign->append = append;
+        i++;
+        if (i + 1 < count && WORDLIKE(views[i + 1].type) && JOINED(&views[i + 1])) {
+          i++;
+          if (views[i].flags & V_OPEN) {
+            assign->items = items(arena, line, views, count, &i, command,
+                                  &assign->nitems);
+            if (!assign->items) {
+              error = i < count ? special(&views[i]) : "newline";
+              break;
+            }
+          } else {
+            assign->value = word(arena, line, views, count, &i, command);
+          }
+        } else {
+          assign->value = "";
+        }
+        // Terminating the name overwrites the '=' or the '+'
+        assign->name[namelen] = '\0';
+        break;
+      }
+      /* Fall through */
+    case T_ASSIGN:
+      command->argv[command->argc++] = word(arena, line, views, count, &i, command);
+      break;
+    case T_PIPE:
+      if (command_empty(command) || i == count - 1) {
+        error = special(view);
+      }
+      command = NULL;
+      break;
+    case T_TOFILE:
+    case T_FROMFILE:
+      if (type == T_TOFILE && i + 1 < count &&
+          views[i + 1].type == T_TOFILE && JOINED(&views[i + 1])) {
+        // >> appends
+        i++;
+        command->append = 1;
+      }
+      if (i + 1 >= count || !WORDLIKE(views[i + 1].type)) {
+        error = i + 1 < count ? special(&views[i + 1]) : "newline";
+        break;
+      }
+      i++;
+      char **file = type == T_TOFILE ? &command->to : &command->from;
+      *file = word(arena, line, views, count, &i, command);
+      break;
+    case T_BACKGROUND:
+      if (i != count - 1 || command_empty(command)) {
+        error = special(view);
+      }
+      pipeline->background = 1;
+      break;
+    default:
+      error = special(view);
+      break;
+    }
+  }
+
+#ifdef LSH_ENABLE_FUNCS
+  if (pipeline && !error) {
+    pipeline->keyword = k;
+    pipeline->ready = ready;
+    if (k == K_FOR) {
+      error = loop_words(arena, pipeline);
+    }
+  }
+#endif
+
+  *errorp = error;
+  return error ? NULL : pipeline;
+}
+
+/*
+ * As parse_pipeline() but a syntax error is reported
+ */
+pipeline_t *
+parse_line(arena_t *arena, char *line, size_t len)
+{
+  const char *error;
+  pipeline_t *pipeline = parse_pipeline(arena, line, len, &error);
+
+  if (error) {
+    fprintf(stderr, "syntax error near unexpected token '%s'\n", error);
+  }
+  return pipeline;
+}
+
+static char *
+copy(arena_t *arena, char *s, int strings)
+{
+  return s && strings ? arena_strndup(arena, s, strlen(s)) : s;
+}
+
+static char **
+copy_words(arena_t *arena, char **words, int count, int strings)
+{
+  char **w = arena_alloc(arena, (count + 1) * sizeof(char *));
+  int i;
+
+  for (i = 0; i < count; i++) {
+    w[i] = copy(arena, words[i], strings);
+  }
+  w[count] = NULL;
+  return w;
+}
+
+/*
+ * A copy of the pipeline in the arena that can be expanded without
+ * touching the original, which is what expanding does to a command.
+ * The words are shared with the original unless strings is set
+ */
+pipeline_t *
+parse_copy(arena_t *arena, pipeline_t *pipeline, int strings)
+{
+  pipeline_t *p = arena_alloc(arena, sizeof(pipeline_t));
+  command_t *command, **tail = &p->commands;
+  int i;
+
+  *p = *pipeline;
+  for (command = pipeline->commands; command; command = command->next) {
+    command_t *c = arena_alloc(arena, sizeof(command_t));
+    *c = *command;
+    c->argv = copy_words(arena, command->argv, command->argc, strings);
+    if (command->nassigns) {
+      c->assigns = arena_alloc(arena, command->nassigns * sizeof(assign_t));
+    }
+    for (i = 0; i < command->nassigns; i++) {
+      assign_t *a = &c->assigns[i];
+      *a = command->assigns[i];
+      a->name = copy(arena, a->name, strings);
+      a->value = copy(arena, a->value, strings);
+      if (a->items) {
+        a->items = copy_words(arena, a->items, a->nitems, strings);
+      }
+    }
+    c->from = copy(arena, command->from, strings);
+    c->to = copy(arena, command->to, strings);
+    *tail = c;
+    tail = &c->next;
+  }
+  *tail = NULL;
+  return p;
+}
+
+void
+parse_print(pipeline_t *pipeline)
+{
+  command_t *command;
+  int stage = 0;
+
+  for (command = pipeline->commands; command; command = command->next) {
+    int i;
+    printf("stage[%d]:", stage++);
+    for (i = 0; i < command->nassigns; i++) {
+      assign_t *assign = &command->assigns[i];
+      printf(" %s%s=", assign->name, assign->append ? "+" : "");
+      if (assign->items) {
+        int j;
+        printf("(");
+        for (j = 0; j < assign->nitems; j++) {
+          printf(j ? " '%s'" : "'%s'", assign->items[j]);
+        }
+        printf(")");
+      } else {
+        printf("'%s'", assign->value);
+      }
+    }
+    for (i = 0; i < command->argc; i++) {
+      printf(" argv[%d]='%s'", i, command->argv[i]);
+    }
+    if (command->from) {
+      printf(" <'%s'", command->from);
+    }
+    if (command->to) {
+      printf(" %s'%s'", command->append ? ">>" : ">", command->to);
+    }
+    printf("\n");
+  }
+  if (pipeline->background) {
+    printf("background\n");
+  }
+}
+
+
+
+#ifdef PARSE_TEST
+
+int main(int argc, char *argv[])
+{
+  arena_t arena = { 0 };
+  char line[] = "A=1 B+=x C=(a 'b c' \"\") ls --color=auto \"a \"'b' = c\\ d < in.txt|sort -u >> out.txt&";
+  pipeline_t *pipeline = parse_line(&arena, line, strlen(line));
+  parse_print(pipeline);
+  arena_free(&arena);
+  exit(0);
+}
+#endif
@@ -0,0 +1,93 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * Command line parser interface
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A <name>=<value>, <name>+=<value> or <name>=(<item> ...) setting
+ */
+typedef struct {
+  char *name;
+  char *value;
+  char **items;             // NULL unless it is an array, NULL terminated
+  int nitems;
+  int append;               // +=
+} assign_t;
+
+/*
+ * A single command, optionally one stage of a pipeline:
+ *
+ * [<name>=<value> ...] [<command> [<arg1> ... <argN>]] [< <file>] [> <file>]
+ */
+typedef struct command {
+  int argc;
+  char **argv;              // NULL terminated
+  int nassigns;
+  assign_t *assigns;
+  char *from;               // < <file>
+  char *to;                 // > <file> or >> <file>
+  int append;
+  int expand;               // Some word has a CTL_EXPAND to expand
+  struct command *next;     // Next stage of the pipeline
+} command_t;
+
+/*
+ * Lines that are not run themselves but open or close a compound
+ * command. Whatever words they take come as the one command
+ */
+typedef enum {
+  K_NONE,
+  K_FUNCTION,               // <name>() {
+  K_CLOSE,                  // }
+  K_IF,                     // if <pipeline>
+  K_ELIF,                   // elif <pipeline>
+  K_THEN,                   // then
+  K_ELSE,                   // else
+  K_FI,                     // fi
+  K_WHILE,                  // while <pipeline>
+  K_FOR,                    // for <name> [in <word> ...], as <name> <word> ...
+  K_DO,                     // do
+  K_DONE                    // done
+} keyword_t;
+
+/*
+ * <command> [| <command> ...] [&]
+ */
+typedef struct pipeline {
+  command_t *commands;
+  int stages;
+  int background;
+  keyword_t keyword;
+  int ready;                // Its line ended with ; then or ; do
+} pipeline_t;
+
+pipeline_t *
+parse_pipeline(arena_t *arena, char *line, size_t len, const char **error);
+
+pipeline_t *
+parse_line(arena_t *arena, char *line, size_t len);
+
+const char *
+parse_keyword(keyword_t keyword);
+
+pipeline_t *
+parse_copy(arena_t *arena, pipeline_t *pipeline, int strings);
+
+void
+parse_print(pipeline_t *pipeline);
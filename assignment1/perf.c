@@ -0,0 +1,200 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * What a command did to the processor (the 'perfstat' internal command)
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE             // For syscall()
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "arena.h"
+#include "symtab.h"
+#include "parse.h"
+#include "zygote.h"
+#include "perf.h"
+#include "lsh.h"
+
+#ifdef LSH_ENABLE_PERF
+
+/*
+ * The counters are opened on the shell itself with inherit set, before
+ * the command is started, so that every process forked or spawned from
+ * then on counts into them too. A child's counts are only added to ours
+ * when it exits, so they are read once the command has been waited for.
+ * What the shell does in between is counted as well, as time counts it.
+ * Each counter is opened on its own rather than as a group: a machine
+ * with no PMU, or a virtual one, still has the software counters, and
+ * the kernel multiplexes any it cannot count at once, which we scale for
+ */
+typedef struct {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+} counter_t;
+
+static const counter_t counters[] = {
+  { "task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+  { "context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+  { "page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+  { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { "cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+  { "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+#define NCOUNTERS (sizeof(counters) / sizeof(counters[0]))
+#define TASK_CLOCK 0
+#define CYCLES 3
+#define INSTRUCTIONS 4
+
+// As read() gives it us with the read_format below
+typedef struct {
+  uint64_t value;
+  uint64_t enabled;
+  uint64_t running;
+} reading_t;
+
+/*
+ * Open a disabled counter on this process and whatever it starts. Where
+ * perf_event_paranoid allows us only user space, count only that, and
+ * say so in user
+ */
+static int
+open_counter(const counter_t *counter, int *user)
+{
+  struct perf_event_attr attr;
+  int fd;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = counter->type;
+  attr.config = counter->config;
+  attr.disabled = 1;
+  attr.inherit = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+  *user = 0;
+  fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+  if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    *user = 1;
+    fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+  }
+  return fd;
+}
+
+/*
+ * perfstat command [arg ...]
+ *
+ * Run a command and say what the processor did running it: cycles,
+ * instructions, cache and branch misses, with the software counters
+ * alongside. Counters this machine does not have are shown as not
+ * supported. Written to standard error as perf stat would
+ */
+int
+lsh_perfstat(int argc, char **argv)
+{
+  command_t command = { 0 };
+  pipeline_t pipeline = { &command, 1, 0 };
+  reading_t readings[NCOUNTERS] = { { 0 } };
+  int fds[NCOUNTERS], user[NCOUNTERS];
+  int status, opened = 0;
+  unsigned i;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s command [arg ...]\n", argv[0]);
+    return 2;
+  }
+  for (i = 0; i < NCOUNTERS; i++) {
+    fds[i] = open_counter(&counters[i], &user[i]);
+    opened += fds[i] >= 0;
+  }
+  if (!opened) {
+    fprintf(stderr, "%s: perf_event_open: %s\n", argv[0], strerror(errno));
+  }
+
+  // Its words were expanded as perfstat's own arguments
+  command.argc = argc - 1;
+  command.argv = &argv[1];
+  zygote_hold(1);
+  for (i = 0; i < NCOUNTERS; i++) {
+    if (fds[i] >= 0) {
+      ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+  status = lsh_execute(&pipeline);
+  for (i = 0; i < NCOUNTERS; i++) {
+    if (fds[i] >= 0) {
+      ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+  }
+  zygote_hold(0);
+
+  for (i = 0; i < NCOUNTERS; i++) {
+    if (fds[i] >= 0) {
+      if (read(fds[i], &readings[i], sizeof(reading_t)) != sizeof(reading_t)) {
+        readings[i].running = 0;
+      }
+      close(fds[i]);
+    }
+  }
+
+  fflush(stdout);
+  for (i = 0; i < NCOUNTERS; i++) {
+    reading_t *r = &readings[i];
+    double value;
+
+    if (fds[i] < 0) {
+      fprintf(stderr, "%20s  %s\n", "<not supported>", counters[i].name);
+      continue;
+    }
+    if (r->running == 0) {
+      fprintf(stderr, "%20s  %s%s\n", "<not counted>", counters[i].name,
+              user[i] ? ":u" : "");
+      continue;
+    }
+    // Scaled up for the time it was multiplexed out
+    value = r->running < r->enabled ?
+            (double)r->value * r->enabled / r->running : r->value;
+    if (i == TASK_CLOCK) {
+      fprintf(stderr, "%20.3f  %s%s (ms)", value / 1e6, counters[i].name,
+              user[i] ? ":u" : "");
+    } else {
+      fprintf(stderr, "%20.0f  %s%s", value, counters[i].name,
+              user[i] ? ":u" : "");
+    }
+    if (i == INSTRUCTIONS && fds[CYCLES] >= 0 && readings[CYCLES].value) {
+      fprintf(stderr, "  # %.2f per cycle",
+              (double)r->value / readings[CYCLES].value);
+    }
+    if (r->running < r->enabled) {
+      fprintf(stderr, "  (%.1f%%)", 100.0 * r->running / r->enabled);
+    }
+    fputc('\n', stderr);
+  }
+  return status;
+}
+#endif /* LSH_ENABLE_PERF */
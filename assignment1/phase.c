@@ -0,0 +1,438 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * Per line phase timing, for benchmarking the shell. Only built in
+ * with LSH_ENABLE_PHASES, which 'make bench' turns on. The report goes
+ * to standard error as the shell exits, or is appended to the file
+ * named by LSH_PHASES in the environment.
+ *
+ * With LSH_ENABLE_TRACE the same phases, and the commands run, can be
+ * traced at run time as spans for chrome://tracing or Perfetto
+ *
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "phase.h"
+
+static const char *names[PHASES] = {
+  [P_READ]     = "read",
+  [P_TOKENISE] = "tokenise",
+  [P_PARSE]    = "parse",
+  [P_RESOLVE]  = "resolve",
+  [P_SEARCH]   = "search",
+  [P_BUILTIN]  = "builtin",
+  [P_SPAWN]    = "spawn",
+  [P_WAIT]     = "wait",
+};
+
+/*
+ * The nanoseconds each line spent in a phase, for the lines that
+ * entered it at all. Slot PHASES is the whole line
+ */
+typedef struct {
+  uint64_t *ns;
+  size_t count;
+  size_t size;
+} samples_t;
+
+#ifdef LSH_ENABLE_PHASES
+static samples_t samples[PHASES + 1];
+static uint64_t started;            // When we entered the first line
+#endif
+static uint64_t line[PHASES];       // The line so far
+static unsigned entered;            // Bit mask of the phases it entered
+static phase_t current = P_READ;
+static uint64_t since;              // When we entered the current phase
+
+static uint64_t
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#ifdef LSH_ENABLE_PHASES
+static void
+add(samples_t *s, uint64_t ns)
+{
+  if (s->count == s->size) {
+    s->size = s->size ? s->size * 2 : 1024;
+    s->ns = realloc(s->ns, s->size * sizeof(uint64_t));
+    if (!s->ns) {
+      abort();
+    }
+  }
+  s->ns[s->count++] = ns;
+}
+#endif
+
+#ifdef LSH_ENABLE_TRACE
+static void
+span(const char *name, int tid, uint64_t start, uint64_t end);
+
+#define TRACK_PHASES    1
+#define TRACK_COMMANDS  2
+#endif
+
+void
+phase_enter(phase_t phase)
+{
+  uint64_t t = now();
+#ifdef LSH_ENABLE_TRACE
+  if (tracing) {
+    span(names[current], TRACK_PHASES, since, t);
+  }
+#endif
+  line[current] += t - since;
+  entered |= 1 << current;
+  current = phase;
+  since = t;
+}
+
+/*
+ * The line is finished. Record where its time went and start timing
+ * the read of the next one
+ */
+void
+phase_line(void)
+{
+  uint64_t total = 0;
+  int p;
+
+  phase_enter(P_READ);
+  for (p = 0; p < PHASES; p++) {
+#ifdef LSH_ENABLE_PHASES
+    if (entered & (1 << p)) {
+      add(&samples[p], line[p]);
+      total += line[p];
+    }
+#endif
+    line[p] = 0;
+  }
+#ifdef LSH_ENABLE_PHASES
+  add(&samples[PHASES], total);
+#else
+  (void)total;
+#endif
+  entered = 0;
+}
+
+#ifdef LSH_ENABLE_PHASES
+static int
+compare(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static uint64_t
+percentile(samples_t *s, int pc)
+{
+  return s->ns[(s->count - 1) * pc / 100];
+}
+
+static void
+report(void)
+{
+  samples_t *all = &samples[PHASES];
+  double elapsed = (now() - started) / 1e9;
+  const char *file = getenv("LSH_PHASES");
+  FILE *out = stderr;
+  int p;
+
+  if (all->count == 0 || (file && (out = fopen(file, "a")) == NULL)) {
+    return;
+  }
+  fprintf(out, "%zu lines in %.3fs, %.0f commands/sec\n",
+          all->count, elapsed, all->count / elapsed);
+  fprintf(out, "%-9s %9s %10s %10s %10s %6s\n",
+          "phase", "lines", "p50 ns", "p99 ns", "mean ns", "share");
+  for (p = 0; p <= PHASES; p++) {
+    samples_t *s = &samples[p];
+    uint64_t sum = 0;
+    size_t i;
+
+    if (s->count == 0) {
+      continue;
+    }
+    for (i = 0; i < s->count; i++) {
+      sum += s->ns[i];
+    }
+    qsort(s->ns, s->count, sizeof(uint64_t), compare);
+    fprintf(out, "%-9s %9zu %10llu %10llu %10llu %5.1f%%\n",
+            p < PHASES ? names[p] : "line", s->count,
+            (unsigned long long)percentile(s, 50),
+            (unsigned long long)percentile(s, 99),
+            (unsigned long long)(sum / s->count),
+            100.0 * sum / (elapsed * 1e9));
+    free(s->ns);
+  }
+  if (out != stderr) {
+    fclose(out);
+  }
+}
+
+void
+phase_init(void)
+{
+  started = since = now();
+  atexit(report);
+}
+#endif /* LSH_ENABLE_PHASES */
+
+#ifdef LSH_ENABLE_TRACE
+/*
+ * A trace is a ring of the most recent spans, each a phase the shell
+ * was in or a command it ran, from when it began to when it ended. A
+ * span is written in place and nothing is ever locked, allocated or
+ * written out until the trace is dumped, so tracing costs no more than
+ * the clock reads. The oldest spans are written over once the ring is
+ * full. Phases go on one track, commands run by the shell itself and
+ * single commands on another and each stage of a pipeline on a track
+ * of its own
+ */
+typedef struct {
+  uint64_t start;
+  uint64_t end;
+  int tid;                          // One of the tracks or a child's pid
+  char name[20];
+} span_t;
+
+#define RING 65536                  // Spans, a power of two
+
+int tracing;
+static span_t *ring;
+static uint64_t head;               // Spans ever recorded
+static uint64_t epoch;              // When the first trace began
+static pid_t tracer;                // Forked copies of us don't dump
+static char *dumpfile;              // LSH_TRACE
+
+static void
+span(const char *name, int tid, uint64_t start, uint64_t end)
+{
+  span_t *s = &ring[head++ & (RING - 1)];
+  size_t len = strlen(name);
+
+  s->start = start;
+  s->end = end;
+  s->tid = tid;
+  if (len > sizeof(s->name) - 1) {
+    // Cut before the character that does not fit, not in the middle of it
+    len = sizeof(s->name) - 1;
+    while (len > 0 && ((unsigned char)name[len] & 0xc0) == 0x80) {
+      len--;
+    }
+  }
+  memcpy(s->name, name, len);
+  s->name[len] = '\0';
+}
+
+uint64_t
+trace_now(void)
+{
+  return now();
+}
+
+/*
+ * A command that started at start has just finished. Give the pid of
+ * a pipeline stage so that it is shown alongside the others
+ */
+void
+trace_command(const char *name, pid_t pid, uint64_t start)
+{
+  span(name, pid > 0 ? pid : TRACK_COMMANDS, start, now());
+}
+
+static void
+start(void)
+{
+  if (!ring) {
+    ring = calloc(RING, sizeof(span_t));
+    epoch = now();
+  }
+  tracer = getpid();
+  tracing = 1;
+  // The phase we are in as of now, whatever came before
+  since = now();
+}
+
+/*
+ * The length of the well formed UTF-8 sequence of more than one byte
+ * at s, or 0 if there isn't one
+ */
+static int
+sequence(const unsigned char *s)
+{
+  unsigned char lo = 0x80, hi = 0xbf;
+  int n, i;
+
+  if (*s < 0xc2 || *s > 0xf4) {
+    return 0;
+  }
+  n = *s < 0xe0 ? 2 : *s < 0xf0 ? 3 : 4;
+  // No overlong forms, surrogates or code points past U+10FFFF
+  if (*s == 0xe0) {
+    lo = 0xa0;
+  } else if (*s == 0xed) {
+    hi = 0x9f;
+  } else if (*s == 0xf0) {
+    lo = 0x90;
+  } else if (*s == 0xf4) {
+    hi = 0x8f;
+  }
+  for (i = 1; i < n; i++) {
+    if (s[i] < lo || s[i] > hi) {
+      return 0;
+    }
+    lo = 0x80;
+    hi = 0xbf;
+  }
+  return n;
+}
+
+/*
+ * Write s as a JSON string. JSON has to be UTF-8, so a byte that is not
+ * part of a well formed sequence is written as the Latin-1 character
+ */
+static void
+quoted(FILE *out, const char *s)
+{
+  const unsigned char *p = (const unsigned char *)s;
+  int n;
+
+  fputc('"', out);
+  for (; *p; p += n ? n : 1) {
+    n = *p < 0x80 ? 1 : sequence(p);
+    if (*p == '"' || *p == '\\') {
+      fprintf(out, "\\%c", *p);
+    } else if (*p < ' ' || n == 0) {
+      fprintf(out, "\\u%04x", *p);
+    } else {
+      fwrite(p, 1, n, out);
+    }
+  }
+  fputc('"', out);
+}
+
+static void
+track(FILE *out, int tid, const char *name)
+{
+  fprintf(out, ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,"
+          "\"tid\":%d,\"args\":{\"name\":", (int)tracer, tid);
+  quoted(out, name);
+  fprintf(out, "}}");
+}
+
+/*
+ * Write the spans in the ring out as Chrome trace events
+ */
+static int
+dump(const char *file)
+{
+  FILE *out = fopen(file, "w");
+  uint64_t i = head > RING ? head - RING : 0;
+
+  if (!out) {
+    perror(file);
+    return 1;
+  }
+  fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+          "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,"
+          "\"args\":{\"name\":\"lsh\"}}", (int)tracer);
+  track(out, TRACK_PHASES, "phases");
+  track(out, TRACK_COMMANDS, "commands");
+  for (; i < head; i++) {
+    span_t *s = &ring[i & (RING - 1)];
+    if (s->tid != TRACK_PHASES && s->tid != TRACK_COMMANDS) {
+      track(out, s->tid, s->name);
+    }
+    fprintf(out, ",\n{\"ph\":\"X\",\"cat\":\"%s\",\"name\":",
+            s->tid == TRACK_PHASES ? "phase" : "command");
+    quoted(out, s->name);
+    fprintf(out, ",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+            (int)tracer, s->tid, (s->start - epoch) / 1e3,
+            (s->end - s->start) / 1e3);
+  }
+  fprintf(out, "\n]}\n");
+  fclose(out);
+  return 0;
+}
+
+static void
+finish(void)
+{
+  if (getpid() == tracer) {
+    tracing = 0;
+    dump(dumpfile);
+  }
+}
+
+/*
+ * Trace from the start if LSH_TRACE names a file, which the trace is
+ * written to as the shell exits
+ */
+void
+trace_init(void)
+{
+  const char *file = getenv("LSH_TRACE");
+
+  if (file && *file) {
+    dumpfile = strdup(file);
+    start();
+    atexit(finish);
+  }
+}
+
+/*
+ * trace [on | off | dump <file>]
+ *
+ * Start or stop tracing, or write out what has been traced so far. On
+ * its own, say whether a trace is being taken
+ */
+int
+lsh_trace(int argc, char **argv)
+{
+  if (argc == 1) {
+    printf("trace %s, %llu spans, %llu kept\n", tracing ? "on" : "off",
+           (unsigned long long)head,
+           (unsigned long long)(head > RING ? RING : head));
+    return 0;
+  }
+  if (argc == 2 && strcmp(argv[1], "on") == 0) {
+    start();
+    current = P_BUILTIN;
+    return 0;
+  }
+  if (argc == 2 && strcmp(argv[1], "off") == 0) {
+    tracing = 0;
+    return 0;
+  }
+  if (argc == 3 && strcmp(argv[1], "dump") == 0) {
+    return ring ? dump(argv[2]) : 1;
+  }
+  fprintf(stderr, "usage: %s [on | off | dump <file>]\n", argv[0]);
+  return 2;
+}
+#endif /* LSH_ENABLE_TRACE */
@@ -0,0 +1,80 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * Per line phase timing interface
+ *
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Where the time taken by each line goes. Time is charged to whichever
+ * phase was last entered until the next is, so every nanosecond of a
+ * line is in exactly one of them
+ */
+typedef enum {
+  P_READ,                   // Waiting for and splitting out the line
+  P_TOKENISE,
+  P_PARSE,
+  P_RESOLVE,                // Settings and finding what to run
+  P_SEARCH,                 // Looking for a command on the PATH
+  P_BUILTIN,                // Running internal commands
+  P_SPAWN,
+  P_WAIT,
+  PHASES
+} phase_t;
+
+#ifdef LSH_ENABLE_PHASES
+void
+phase_init(void);
+#endif
+
+void
+phase_enter(phase_t phase);
+
+void
+phase_line(void);
+
+#ifdef LSH_ENABLE_TRACE
+#include <stdint.h>
+#include <sys/types.h>
+
+extern int tracing;
+
+void
+trace_init(void);
+
+uint64_t
+trace_now(void);
+
+void
+trace_command(const char *name, pid_t pid, uint64_t start);
+
+int
+lsh_trace(int argc, char **argv);
+#endif
+
+#if defined(LSH_ENABLE_PHASES)
+#define PHASE(p)      phase_enter(p)
+#define PHASE_LINE()  phase_line()
+#elif defined(LSH_ENABLE_TRACE)
+// Only a test of a flag unless a trace is being taken
+#define PHASE(p)      do { if (tracing) phase_enter(p); } while (0)
+#define PHASE_LINE()  do { if (tracing) phase_line(); } while (0)
+#else
+#define PHASE(p)
+#define PHASE_LINE()
+#endif
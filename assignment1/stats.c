@@ -0,0 +1,344 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * What every command has cost (the 'time' and 'stats' internal commands)
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "arena.h"
+#include "symtab.h"
+#include "parse.h"
+#include "stats.h"
+#include "lsh.h"
+
+#ifdef LSH_ENABLE_STATS
+
+/*
+ * Every command run is charged to its name for the rest of the session:
+ * the wall clock time it took and, for children, what wait4() says it
+ * used. Internal commands run by the shell itself are only timed, since
+ * asking the kernel for our own usage would cost more than most of them
+ * take. Names are found through an open addressing hash of them
+ */
+#define BUCKETS 32              // Runs by wall time, a power of two us each
+
+typedef struct {
+  char *name;                   // NULL if the slot is free
+  unsigned long runs;
+  int64_t wall;                 // ns
+  int64_t user;                 // us
+  int64_t sys;                  // us
+  long maxrss;                  // kB, the most any one run used
+  long minflt;
+  long majflt;
+  long nvcsw;
+  long nivcsw;
+  unsigned long hist[BUCKETS];
+} stat_t;
+
+static stat_t *stats;
+static unsigned size;           // A power of two
+static unsigned used;
+
+// Everything ever waited for, which 'time' takes the difference of
+static stat_t total;
+
+static unsigned
+home(const char *name)
+{
+  unsigned h = 2166136261u;
+
+  while (*name) {
+    h = (h ^ (unsigned char)*name++) * 16777619u;
+  }
+  return h & (size - 1);
+}
+
+static stat_t *
+slot(const char *name)
+{
+  unsigned i;
+
+  for (i = home(name); stats[i].name; i = (i + 1) & (size - 1)) {
+    if (strcmp(stats[i].name, name) == 0) {
+      break;
+    }
+  }
+  return &stats[i];
+}
+
+/*
+ * The entry for name, made if it is new. Keep the hash at most half full
+ */
+static stat_t *
+entry(const char *name)
+{
+  stat_t *stat;
+
+  if ((used + 1) * 2 > size) {
+    stat_t *old = stats;
+    unsigned n = size, i;
+
+    size = size ? size * 2 : 64;
+    stats = calloc(size, sizeof(stat_t));
+    for (i = 0; i < n; i++) {
+      if (old[i].name) {
+        *slot(old[i].name) = old[i];
+      }
+    }
+    free(old);
+  }
+  stat = slot(name);
+  if (!stat->name) {
+    stat->name = strdup(name);
+    used++;
+  }
+  return stat;
+}
+
+static int64_t
+micros(const struct timeval *tv)
+{
+  return (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static void
+charge(stat_t *stat, const struct rusage *usage)
+{
+  stat->user += micros(&usage->ru_utime);
+  stat->sys += micros(&usage->ru_stime);
+  if (usage->ru_maxrss > stat->maxrss) {
+    stat->maxrss = usage->ru_maxrss;
+  }
+  stat->minflt += usage->ru_minflt;
+  stat->majflt += usage->ru_majflt;
+  stat->nvcsw += usage->ru_nvcsw;
+  stat->nivcsw += usage->ru_nivcsw;
+}
+
+int64_t
+stats_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Charge a run of the command name that took wall ns, and if it was a
+ * child the usage wait4() gave for it
+ */
+void
+stats_record(const char *name, int64_t wall, const struct rusage *usage)
+{
+  stat_t *stat = entry(name);
+  int64_t us = wall / 1000;
+  int b = 0;
+
+  while (us > 1 && b < BUCKETS - 1) {
+    us >>= 1;
+    b++;
+  }
+  stat->runs++;
+  stat->wall += wall;
+  stat->hist[b]++;
+  if (usage) {
+    charge(stat, usage);
+    charge(&total, usage);
+  }
+}
+
+/*
+ * Format ns as a duration in whichever unit suits it
+ */
+static char *
+duration(char *buf, int64_t ns)
+{
+  if (ns >= 1000000000) {
+    sprintf(buf, "%.3fs", ns / 1e9);
+  } else if (ns >= 1000000) {
+    sprintf(buf, "%.1fms", ns / 1e6);
+  } else {
+    sprintf(buf, "%.1fus", ns / 1e3);
+  }
+  return buf;
+}
+
+static int
+by_wall(const void *a, const void *b)
+{
+  const stat_t *x = *(const stat_t **)a, *y = *(const stat_t **)b;
+  return x->wall < y->wall ? 1 : x->wall > y->wall ? -1 : strcmp(x->name, y->name);
+}
+
+static void
+histogram(stat_t *stat)
+{
+  unsigned long most = 0;
+  char lo[16], hi[16];
+  int b, first = -1, last = 0;
+
+  for (b = 0; b < BUCKETS; b++) {
+    if (stat->hist[b]) {
+      first = first < 0 ? b : first;
+      last = b;
+      most = stat->hist[b] > most ? stat->hist[b] : most;
+    }
+  }
+  printf("%s\n", stat->name);
+  for (b = first; b >= 0 && b <= last; b++) {
+    int bar = (int)(stat->hist[b] * 40 / most);
+    printf("  %9s .. %-9s %8lu %.*s\n", duration(lo, b ? (1000LL << b) : 0),
+           duration(hi, 2000LL << b), stat->hist[b], bar,
+           "########################################");
+  }
+}
+
+/*
+ * stats [-r] [-h [name ...]]
+ *
+ * Show what each command run this session has cost, the most costly
+ * first, or with -h how the times of its runs were spread. -r forgets
+ * everything so far
+ */
+int
+lsh_stats(int argc, char **argv)
+{
+  stat_t **sorted;
+  unsigned i, n = 0;
+  int opt, hist = 0;
+
+  optind = 0;
+  while ((opt = getopt(argc, argv, "+hr")) != -1) {
+    switch (opt) {
+    case 'h':
+      hist = 1;
+      break;
+    case 'r':
+      for (i = 0; i < size; i++) {
+        free(stats[i].name);
+      }
+      free(stats);
+      stats = NULL;
+      size = used = 0;
+      return 0;
+    default:
+      fprintf(stderr, "usage: %s [-r] [-h [name ...]]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  if (hist && optind < argc) {
+    int status = 0;
+    for (; optind < argc; optind++) {
+      stat_t *stat = size ? slot(argv[optind]) : NULL;
+      if (!stat || !stat->name) {
+        fprintf(stderr, "%s: %s: not run yet\n", argv[0], argv[optind]);
+        status = 1;
+        continue;
+      }
+      histogram(stat);
+    }
+    return status;
+  }
+
+  sorted = malloc((used + 1) * sizeof(stat_t *));
+  for (i = 0; i < size; i++) {
+    if (stats[i].name) {
+      sorted[n++] = &stats[i];
+    }
+  }
+  qsort(sorted, n, sizeof(stat_t *), by_wall);
+  if (!hist) {
+    printf("%-16s %8s %10s %10s %10s %10s %9s\n",
+           "command", "runs", "total", "mean", "user", "sys", "maxrss");
+  }
+  for (i = 0; i < n; i++) {
+    stat_t *stat = sorted[i];
+    char t[16], m[16], u[16], s[16];
+    if (hist) {
+      histogram(stat);
+      continue;
+    }
+    printf("%-16s %8lu %10s %10s %10s %10s %8ldk\n", stat->name, stat->runs,
+           duration(t, stat->wall), duration(m, stat->wall / stat->runs),
+           duration(u, stat->user * 1000), duration(s, stat->sys * 1000),
+           stat->maxrss);
+  }
+  free(sorted);
+  return 0;
+}
+
+/*
+ * time [command [arg ...]]
+ *
+ * Run a command and say how long it took and what it and the shell
+ * used on its behalf
+ */
+int
+lsh_time(int argc, char **argv)
+{
+  command_t command = { 0 };
+  pipeline_t pipeline = { &command, 1, 0 };
+  struct rusage self, now;
+  stat_t before = total;
+  int64_t start, wall;
+  int status = 0;
+  long maxrss;
+
+  // Its words were expanded as time's own arguments
+  command.argc = argc - 1;
+  command.argv = &argv[1];
+  total.maxrss = 0;
+  getrusage(RUSAGE_SELF, &self);
+  start = stats_now();
+  if (command.argc > 0) {
+    status = lsh_execute(&pipeline);
+  }
+  wall = stats_now() - start;
+  getrusage(RUSAGE_SELF, &now);
+
+  maxrss = total.maxrss;
+  if (before.maxrss > total.maxrss) {
+    total.maxrss = before.maxrss;
+  }
+  fflush(stdout);
+  fprintf(stderr, "real\t%.3fs\n", wall / 1e9);
+  fprintf(stderr, "user\t%.3fs\n", (total.user - before.user +
+          micros(&now.ru_utime) - micros(&self.ru_utime)) / 1e6);
+  fprintf(stderr, "sys\t%.3fs\n", (total.sys - before.sys +
+          micros(&now.ru_stime) - micros(&self.ru_stime)) / 1e6);
+  fprintf(stderr, "maxrss\t%ldk\n", maxrss);
+  fprintf(stderr, "faults\t%ld major %ld minor\n",
+          total.majflt - before.majflt + now.ru_majflt - self.ru_majflt,
+          total.minflt - before.minflt + now.ru_minflt - self.ru_minflt);
+  fprintf(stderr, "switches\t%ld voluntary %ld involuntary\n",
+          total.nvcsw - before.nvcsw + now.ru_nvcsw - self.ru_nvcsw,
+          total.nivcsw - before.nivcsw + now.ru_nivcsw - self.ru_nivcsw);
+  return status;
+}
+#endif /* LSH_ENABLE_STATS */
@@ -0,0 +1,35 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * Command accounting interface
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <sys/resource.h>
+
+int64_t
+stats_now(void);
+
+void
+stats_record(const char *name, int64_t wall, const struct rusage *usage);
+
+int
+lsh_stats(int argc, char **argv);
+
+int
+lsh_time(int argc, char **argv);
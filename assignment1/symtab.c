@@ -26,123 +26,624 @@
 #include "symtab.h"
 
 /*
- * Implemented as push down linked-list. Add new entries at the head
+ * Implemented as an open addressing hash table with linear probing.
+ * Each slot keeps the hash of its symbol's name so most mismatches are
+ * rejected without a strcmp().
+ *
+ * When the table gets too full a table twice the size is started and
+ * the old one is drained into it a few slots at a time by each
+ * subsequent change, rather than all at once. Until it is empty both
+ * tables are searched. A symbol is only ever in one of them
  */
 
-symbol_t *
-symtab_set(symbol_t *symtab, char *name, stype_t type, void *value)
+#define INITIAL_SIZE  16        // Must be a power of two
+#define MIGRATE_STEP  8         // Old slots moved on each change
+#define REMOVED       ((symbol_t *)-1)
+
+typedef struct {
+  unsigned hash;
+  symbol_t *symbol;             // NULL if never used, REMOVED if deleted
+} slot_t;
+
+typedef struct {
+  slot_t *slots;
+  unsigned size;
+  unsigned used;                // Including REMOVED slots
+} table_t;
+
+struct symtab {
+  table_t table;
+  table_t old;                  // Being drained into table
+  unsigned drained;             // Slots of old already moved
+  int count;
+  unsigned generation;          // Bumped by any change to the environment
+};
+
+/*
+ * Anything derived from the table, such as the command hash, is told
+ * about changes through this
+ */
+static symtab_notify_t notify;
+
+void
+symtab_notify(symtab_notify_t fn)
 {
-  symbol_t *symbol = symtab_lookup(symtab, name);
-  if (symbol == NULL) {
-    symbol = (symbol_t *)malloc(sizeof(symbol_t));
-    symbol->name = strdup(name);
-    symbol->next = symtab;
-    symbol->value = NULL;
-    symtab = symbol;
+  notify = fn;
+}
+
+/*
+ * The values of functions belong to whoever defines them, and are
+ * handed back through this when they are done with
+ */
+static symtab_dispose_t dispose;
+
+void
+symtab_dispose(symtab_dispose_t fn)
+{
+  dispose = fn;
+}
+
+/*
+ * Tell anyone who needs to know that a symbol has changed
+ */
+static void
+changed(symtab_t *symtab, symbol_t *symbol, const char *name)
+{
+  if (symbol && symbol->exported) {
+    symtab->generation++;
   }
-  if (type == SYM_VAR) {
-    value = strdup(value);
+  if (notify) {
+    notify(name);
   }
-  if (symbol->value) {
-    free(symbol->value);
+}
+
+static unsigned
+hash(const char *name)
+{
+  // FNV-1a
+  unsigned h = 2166136261u;
+  while (*name) {
+    h = (h ^ (unsigned char)*name++) * 16777619u;
   }
-  symbol->type = type;
-  symbol->value = value;
+  return h;
+}
+
+/*
+ * The slot holding the name, or NULL
+ */
+static slot_t *
+find(table_t *table, const char *name, unsigned h)
+{
+  unsigned mask = table->size - 1, i;
+
+  if (!table->slots) {
+    return NULL;
+  }
+  for (i = h & mask; table->slots[i].symbol; i = (i + 1) & mask) {
+    slot_t *slot = &table->slots[i];
+    if (slot->hash == h && slot->symbol != REMOVED &&
+        strcmp(slot->symbol->name, name) == 0) {
+      return slot;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Place a symbol known not to be in the table already
+ */
+static void
+place(table_t *table, symbol_t *symbol)
+{
+  unsigned mask = table->size - 1, i;
+
+  for (i = symbol->hash & mask; table->slots[i].symbol; i = (i + 1) & mask) {
+    if (table->slots[i].symbol == REMOVED) {
+      // Reuse the slot, it is already counted as used
+      table->used--;
+      break;
+    }
+  }
+  table->slots[i].hash = symbol->hash;
+  table->slots[i].symbol = symbol;
+  table->used++;
+}
+
+/*
+ * Move a few more symbols out of the old table, or all of them
+ */
+static void
+drain(symtab_t *symtab, unsigned step)
+{
+  table_t *old = &symtab->old;
+
+  while (old->slots && step-- > 0) {
+    if (symtab->drained == old->size) {
+      free(old->slots);
+      old->slots = NULL;
+      break;
+    }
+    slot_t *slot = &old->slots[symtab->drained++];
+    if (slot->symbol && slot->symbol != REMOVED) {
+      place(&symtab->table, slot->symbol);
+      slot->symbol = REMOVED;
+    }
+  }
+}
+
+/*
+ * Make sure there is room for one more symbol. Past three quarters full
+ * we start again with a table twice the size (or the same size if it
+ * is mostly REMOVED slots) and drain the current one into it over time
+ */
+static void
+reserve(symtab_t *symtab)
+{
+  table_t *table = &symtab->table;
+
+  if ((table->used + 1) * 4 > table->size * 3) {
+    // A resize must finish before another can start
+    drain(symtab, (unsigned)-1);
+    symtab->old = *table;
+    symtab->drained = 0;
+    table->size = symtab->count * 2 > table->size / 2 ? table->size * 2 : table->size;
+    table->slots = calloc(table->size, sizeof(slot_t));
+    table->used = 0;
+  }
+  drain(symtab, MIGRATE_STEP);
+}
+
+static symtab_t *
+symtab_new(void)
+{
+  symtab_t *symtab = calloc(1, sizeof(symtab_t));
+  symtab->table.size = INITIAL_SIZE;
+  symtab->table.slots = calloc(INITIAL_SIZE, sizeof(slot_t));
   return symtab;
 }
 
-symbol_t *
-symtab_remove(symbol_t *symtab, char *name)
-{
-  symbol_t *symbol = symtab, *prev = NULL;
-
-  while (symbol) {
-    if (strcmp(symbol->name, name) == 0) {
-      if (prev) {
-        prev->next = symbol->next;
-        free(symbol);
-        break;
-      } else {
-        symtab = symbol->next;
-        free(symbol);
-        break;
-      }
+static slot_t *
+search(symtab_t *symtab, const char *name, unsigned h)
+{
+  slot_t *slot = find(&symtab->table, name, h);
+  if (!slot && symtab->old.slots) {
+    slot = find(&symtab->old, name, h);
+  }
+  return slot;
+}
+
+/*
+ * The symbol called name, added with no value if it is not there yet
+ */
+static symbol_t *
+entry(symtab_t *symtab, char *name)
+{
+  unsigned h = hash(name);
+  slot_t *slot = search(symtab, name, h);
+  symbol_t *symbol;
+
+  if (slot) {
+    return slot->symbol;
+  }
+  reserve(symtab);
+  symbol = calloc(1, sizeof(symbol_t));
+  symbol->name = strdup(name);
+  symbol->hash = h;
+  symbol->type = SYM_VAR;
+  place(&symtab->table, symbol);
+  symtab->count++;
+  return symbol;
+}
+
+static void
+array_free(array_t *array)
+{
+  if (array) {
+    free(array->items);
+    free(array->pool);
+    free(array);
+  }
+}
+
+/*
+ * Copy count more items on to the end of an array. The text of every
+ * item lives in the one pool, so adding an item is a copy rather than
+ * an allocation except when the pool or the item pointers fill up,
+ * and then they double
+ */
+static void
+array_add(array_t *array, int count, char **items)
+{
+  size_t need = 0;
+  int i;
+
+  for (i = 0; i < count; i++) {
+    need += strlen(items[i]) + 1;
+  }
+  if (array->count + count > array->size || !array->items) {
+    int size = array->size * 2;
+    array->size = size > array->count + count ? size : array->count + count;
+    array->items = realloc(array->items, (array->size + 1) * sizeof(char *));
+  }
+  if (array->used + need > array->room) {
+    size_t room = array->room ? array->room * 2 : 64;
+    char *pool;
+
+    room = room > array->used + need ? room : array->used + need;
+    pool = malloc(room);
+    if (array->used) {
+      memcpy(pool, array->pool, array->used);
+    }
+    // The items already there move with the text
+    for (i = 0; i < array->count; i++) {
+      array->items[i] = pool + (array->items[i] - array->pool);
     }
-    prev = symbol;
-    symbol = symbol->next;
+    free(array->pool);
+    array->pool = pool;
+    array->room = room;
+  }
+  for (i = 0; i < count; i++) {
+    size_t len = strlen(items[i]) + 1;
+    char *item = &array->pool[array->used];
+    memcpy(item, items[i], len);
+    array->used += len;
+    array->items[array->count++] = item;
+  }
+  array->items[array->count] = NULL;
+}
+
+/*
+ * Let go of the symbol's value ahead of one of another type
+ */
+static void
+clear(symbol_t *symbol)
+{
+  if (symbol->type == SYM_VAR) {
+    free(symbol->value);
+    symbol->size = 0;
+  } else if (symbol->type == SYM_ARRAY) {
+    array_free(symbol->value);
+  } else if (symbol->type == SYM_FUNC && dispose) {
+    dispose(symbol->value);
   }
+  symbol->value = NULL;
+}
+
+/*
+ * A string is copied into the space the last one had if it fits, so
+ * a variable that is updated over and over settles into one buffer
+ */
+static void
+set_string(symbol_t *symbol, const char *value)
+{
+  size_t len = strlen(value) + 1;
+
+  if (symbol->type != SYM_VAR) {
+    clear(symbol);
+    symbol->type = SYM_VAR;
+  }
+  if (len > symbol->size) {
+    size_t size = symbol->size * 2 > len ? symbol->size * 2 : len;
+    size = (size + 15) & ~(size_t)15;
+    symbol->value = realloc(symbol->value, size);
+    symbol->size = size;
+  }
+  memmove(symbol->value, value, len);
+}
+
+/*
+ * The previous items are dropped but their storage is kept for the new
+ */
+static void
+set_array(symbol_t *symbol, int count, char **items)
+{
+  array_t *array;
+
+  if (symbol->type != SYM_ARRAY) {
+    clear(symbol);
+    symbol->type = SYM_ARRAY;
+    symbol->value = calloc(1, sizeof(array_t));
+  }
+  array = symbol->value;
+  array->count = 0;
+  array->used = 0;
+  array_add(array, count, items);
+}
+
+static int
+count(char **items)
+{
+  int n = 0;
+  while (items[n]) {
+    n++;
+  }
+  return n;
+}
+
+/*
+ * Set name to value. A SYM_VAR value is a string and is copied, a
+ * SYM_INT value points to an int64_t and a SYM_ARRAY value is a NULL
+ * terminated list of strings, which are copied too. Anything else is
+ * stored as it is
+ */
+symtab_t *
+symtab_set(symtab_t *symtab, char *name, stype_t type, void *value)
+{
+  symbol_t *symbol;
+
+  if (!symtab) {
+    symtab = symtab_new();
+  }
+  symbol = entry(symtab, name);
+  switch (type) {
+  case SYM_VAR:
+    set_string(symbol, value);
+    break;
+  case SYM_INT:
+    if (symbol->type != SYM_INT) {
+      clear(symbol);
+      symbol->type = SYM_INT;
+    }
+    symbol->number = *(int64_t *)value;
+    // Not formatted until someone asks for it as a string
+    symbol->value = NULL;
+    break;
+  case SYM_ARRAY:
+    set_array(symbol, count(value), value);
+    break;
+  default:
+    clear(symbol);
+    symbol->type = type;
+    symbol->value = value;
+    break;
+  }
+  changed(symtab, symbol, name);
   return symtab;
 }
- 
-symbol_t *
-symtab_lookup(symbol_t *symtab, char *name)
+
+symtab_t *
+symtab_set_int(symtab_t *symtab, char *name, int64_t number)
+{
+  return symtab_set(symtab, name, SYM_INT, &number);
+}
+
+symtab_t *
+symtab_set_array(symtab_t *symtab, char *name, int count, char **items)
+{
+  symbol_t *symbol;
+
+  if (!symtab) {
+    symtab = symtab_new();
+  }
+  symbol = entry(symtab, name);
+  set_array(symbol, count, items);
+  changed(symtab, symbol, name);
+  return symtab;
+}
+
+/*
+ * Add items to the end of an array. A variable that is not yet an
+ * array becomes one, with its value, if it has one, as the first item
+ */
+symtab_t *
+symtab_append(symtab_t *symtab, char *name, int count, char **items)
 {
-  symbol_t *symbol = symtab;
+  symbol_t *symbol;
 
-  while (symbol) {
-    if (strcmp(symbol->name, name) == 0) {
-      return symbol;
+  if (!symtab) {
+    symtab = symtab_new();
+  }
+  symbol = entry(symtab, name);
+  if (symbol->type != SYM_ARRAY) {
+    array_t *array = calloc(1, sizeof(array_t));
+    char *first = (char *)symtab_string(symbol);
+    array_add(array, first ? 1 : 0, &first);
+    clear(symbol);
+    symbol->type = SYM_ARRAY;
+    symbol->value = array;
+  }
+  array_add(symbol->value, count, items);
+  changed(symtab, symbol, name);
+  return symtab;
+}
+
+/*
+ * The value of a variable as a string: an integer is formatted the
+ * first time it is asked for after a change and an array gives its
+ * first item. NULL for anything that is not a variable
+ */
+const char *
+symtab_string(symbol_t *symbol)
+{
+  switch (symbol->type) {
+  case SYM_VAR:
+    return symbol->value;
+  case SYM_INT:
+    if (!symbol->value) {
+      snprintf(symbol->digits, sizeof(symbol->digits), "%lld",
+               (long long)symbol->number);
+      symbol->value = symbol->digits;
     }
-    symbol = symbol->next;
+    return symbol->value;
+  case SYM_ARRAY:
+    return ((array_t *)symbol->value)->count ?
+           ((array_t *)symbol->value)->items[0] : "";
+  default:
+    return NULL;
   }
-  return NULL;
+}
+
+/*
+ * Mark a variable as one to pass on to commands, or not. A name with
+ * no value yet can be exported but has nothing to pass on until it is
+ * given one
+ */
+symtab_t *
+symtab_export(symtab_t *symtab, char *name, int exported)
+{
+  symbol_t *symbol;
+
+  if (!symtab) {
+    symtab = symtab_new();
+  }
+  symbol = entry(symtab, name);
+  if (symbol->exported != exported) {
+    symbol->exported = exported;
+    symtab->generation++;
+  }
+  return symtab;
+}
+
+/*
+ * Changes whenever the value of an exported variable, or which are
+ * exported, does. Anything built from them need only be built again
+ * when this is different from when it was last built
+ */
+unsigned
+symtab_generation(symtab_t *symtab)
+{
+  return symtab ? symtab->generation : 0;
+}
+
+static void
+release(symbol_t *symbol)
+{
+  clear(symbol);
+  free(symbol->name);
+  free(symbol);
+}
+
+symtab_t *
+symtab_remove(symtab_t *symtab, char *name)
+{
+  slot_t *slot = symtab ? search(symtab, name, hash(name)) : NULL;
+
+  if (slot) {
+    symtab->generation += slot->symbol->exported;
+    release(slot->symbol);
+    // Leave a marker so probes carry on past this slot
+    slot->symbol = REMOVED;
+    symtab->count--;
+  }
+  if (notify) {
+    notify(name);
+  }
+  return symtab;
+}
+ 
+symbol_t *
+symtab_lookup(symtab_t *symtab, char *name)
+{
+  slot_t *slot = symtab ? search(symtab, name, hash(name)) : NULL;
+  return slot ? slot->symbol : NULL;
 }
 
 void *
-symtab_fetch(symbol_t *symtab, char *name, void *value)
+symtab_fetch(symtab_t *symtab, char *name, void *value)
 {
   symbol_t *symbol = symtab_lookup(symtab, name);
-  return symbol ? symbol->value : value;
+
+  if (!symbol) {
+    return value;
+  }
+  if (symbol->type == SYM_INTERNAL) {
+    return symbol->value;
+  }
+  return symtab_string(symbol) ? (void *)symtab_string(symbol) : value;
 }
 
 int
-symtab_size(symbol_t *symtab)
+symtab_size(symtab_t *symtab)
 {
-  symbol_t *symbol = symtab;
-  int size = 0;
+  return symtab ? symtab->count : 0;
+}
 
-  while (symbol) {
-    size++;
-    symbol = symbol->next;
+static void
+table_free(table_t *table)
+{
+  unsigned i;
+  for (i = 0; table->slots && i < table->size; i++) {
+    symbol_t *symbol = table->slots[i].symbol;
+    if (symbol && symbol != REMOVED) {
+      release(symbol);
+    }
   }
-  return size;
+  free(table->slots);
 }
 
 void
-symtab_free(symbol_t *symtab)
+symtab_free(symtab_t *symtab)
 {
-  symbol_t *symbol = symtab;
+  if (symtab) {
+    table_free(&symtab->table);
+    table_free(&symtab->old);
+    free(symtab);
+  }
+}
 
-  while (symbol) {
-    free(symbol->name);
-    if (symbol-> type == SYM_VAR) {
-      free(symbol->value);
+static void
+table_walk(table_t *table, symtab_visit_t fn, void *arg)
+{
+  unsigned i;
+  for (i = 0; table->slots && i < table->size; i++) {
+    symbol_t *symbol = table->slots[i].symbol;
+    if (symbol && symbol != REMOVED) {
+      fn(symbol, arg);
     }
-    symbol_t *next = symbol->next;
-    free(symbol);
-    symbol = next;
   }
 }
- 
+
+/*
+ * Call fn for every symbol, in no particular order. It must not change
+ * the table
+ */
 void
-symtab_print(symbol_t *symtab)
+symtab_walk(symtab_t *symtab, symtab_visit_t fn, void *arg)
 {
-  symbol_t *symbol = symtab;
+  if (symtab) {
+    table_walk(&symtab->table, fn, arg);
+    table_walk(&symtab->old, fn, arg);
+  }
+}
 
-  while (symbol) {
-    printf("%s", symbol->name);
-    if (symbol->type == SYM_VAR) {
-      printf(" => '%s'", (char *)symbol->value);
+static void
+table_print(table_t *table)
+{
+  unsigned i;
+  for (i = 0; table->slots && i < table->size; i++) {
+    symbol_t *symbol = table->slots[i].symbol;
+    if (symbol && symbol != REMOVED) {
+      printf("%s", symbol->name);
+      if (symbol->type == SYM_ARRAY) {
+        array_t *array = symbol->value;
+        int j;
+        printf(" => (");
+        for (j = 0; j < array->count; j++) {
+          printf(j ? " '%s'" : "'%s'", array->items[j]);
+        }
+        printf(")");
+      } else if (symtab_string(symbol)) {
+        printf(" => '%s'", symtab_string(symbol));
+      }
+      printf("\n");
     }
-    printf("\n");
-    symbol = symbol->next;
+  }
+}
+ 
+void
+symtab_print(symtab_t *symtab)
+{
+  if (symtab) {
+    table_print(&symtab->table);
+    table_print(&symtab->old);
   }
 }
 
 #ifdef SYMTAB_TEST
 
-symbol_t *symtab;
+symtab_t *symtab;
 #include <stdarg.h>
+#include <time.h>
 
 static void fail(const char *fmt, ...)
 {
@@ -153,6 +654,73 @@ static void fail(const char *fmt, ...)
   exit(1);
 }
 
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+#define TIMED(what, n, stmt) do {                                     \
+    double start_ = now();                                            \
+    for (i = 0; i < (n); i++) {                                       \
+      stmt;                                                           \
+    }                                                                 \
+    printf("%7d %-8s %8.1f ns/op\n", (n), what, (now() - start_) / (n)); \
+  } while (0)
+
+/*
+ * Time each operation on a table of n variables, checking the table
+ * still holds what it should as we go
+ */
+static void bench(int n)
+{
+  symtab_t *table = NULL;
+  char **names = malloc(n * sizeof(char *));
+  char buf[32];
+  int i;
+
+  for (i = 0; i < n; i++) {
+    snprintf(buf, sizeof(buf), "VAR_%d", i);
+    names[i] = strdup(buf);
+  }
+
+  TIMED("set", n, table = symtab_set(table, names[i], SYM_VAR, "value"));
+  TIMED("update", n, table = symtab_set(table, names[i], SYM_VAR, "other"));
+  TIMED("lookup", n, if (!symtab_lookup(table, names[i])) fail("Lost '%s'\n", names[i]));
+  TIMED("fetch", n, if (strcmp(symtab_fetch(table, names[i], ""), "other") != 0) fail("Bad value for '%s'\n", names[i]));
+  TIMED("miss", n, if (symtab_lookup(table, "NOT_A_VAR")) fail("Found what isn't there\n"));
+  TIMED("setint", n, table = symtab_set_int(table, names[i], i));
+  TIMED("append", n, table = symtab_append(table, "ARGS", 1, &names[i]));
+  if (strcmp(symtab_fetch(table, names[n - 1], ""), names[n - 1] + 4) != 0) {
+    fail("Bad integer value for '%s'\n", names[n - 1]);
+  }
+  array_t *args = symtab_lookup(table, "ARGS")->value;
+  if (args->count != n || strcmp(args->items[n - 1], names[n - 1]) != 0 ||
+      args->items[n] != NULL) {
+    fail("Appended array is wrong\n");
+  }
+  table = symtab_remove(table, "ARGS");
+  if (symtab_size(table) != n) {
+    fail("Expected size to be %d but got '%d'\n", n, symtab_size(table));
+  }
+  TIMED("remove", n / 2, table = symtab_remove(table, names[i * 2]));
+  for (i = 0; i < n; i++) {
+    if ((symtab_lookup(table, names[i]) == NULL) != (i % 2 == 0)) {
+      fail("Remove of every other symbol went wrong at '%s'\n", names[i]);
+    }
+  }
+  if (symtab_size(table) != n / 2) {
+    fail("Expected size to be %d but got '%d'\n", n / 2, symtab_size(table));
+  }
+
+  symtab_free(table);
+  for (i = 0; i < n; i++) {
+    free(names[i]);
+  }
+  free(names);
+}
+
 int main(int argc, char *argv[])
 {
   // Add a symbol
@@ -194,7 +762,28 @@ int main(int argc, char *argv[])
     fail("Expected size to be 1 but got '%d'\n", size);
   }
 
+  // Integers and arrays
+  symtab = symtab_set_int(symtab, "N", -42);
+  symbol = symtab_lookup(symtab, "N");
+  if (symbol->type != SYM_INT || symbol->number != -42 ||
+      strcmp(symtab_string(symbol), "-42") != 0) {
+    fail("Bad integer\n");
+  }
+  char *items[] = { "a", "b c", NULL };
+  symtab = symtab_set(symtab, "A", SYM_ARRAY, items);
+  symtab = symtab_append(symtab, "N", 2, items);
+  symbol = symtab_lookup(symtab, "N");
+  array_t *array = symbol->value;
+  if (symbol->type != SYM_ARRAY || array->count != 3 ||
+      strcmp(array->items[0], "-42") != 0 || strcmp(array->items[2], "b c") != 0) {
+    fail("Bad append to an integer\n");
+  }
+  symtab = symtab_remove(symtab, "N");
+
   symtab_print(symtab);
+
+  bench(10000);
+  bench(100000);
   exit(0);
 }
 #endif
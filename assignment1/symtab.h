@@ -20,33 +20,105 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdint.h>
+
 typedef enum {
   SYM_VAR,
-  SYM_INTERNAL
+  SYM_INT,
+  SYM_ARRAY,
+  SYM_INTERNAL,
+  SYM_FUNC                  // Owned by whoever set it, see symtab_dispose()
 } stype_t;
 
+/*
+ * The value of a SYM_ARRAY. The items are kept contiguous and NULL
+ * terminated so they can be used as, or copied into, an argv. Their
+ * text is packed one after another into a single pool
+ */
+typedef struct {
+  char **items;
+  int count;
+  int size;                 // Allocated, not counting the NULL
+  char *pool;
+  size_t used;
+  size_t room;
+} array_t;
+
 typedef struct symbol {
   char *name;
-  void *value;
+  void *value;              // String, array_t or function, by type
   stype_t type;
-  struct symbol *next;
+  unsigned hash;            // Of the name, so it is only computed once
+  size_t size;              // Allocated for a SYM_VAR string
+  int64_t number;           // Of a SYM_INT
+  char digits[24];          // The number, once it has been formatted
+  int exported;             // Passed on in the environment of commands
 } symbol_t;
 
-symbol_t *
-symtab_set(symbol_t *symtab, char *name, stype_t type, void *value);
+/*
+ * The table itself. A NULL symtab_t * is an empty table and is replaced
+ * by the one symtab_set() returns
+ */
+typedef struct symtab symtab_t;
+
+/*
+ * Hook called with the name of any symbol that is set or removed
+ */
+typedef void (* symtab_notify_t)(const char *name);
+
+void
+symtab_notify(symtab_notify_t fn);
+
+/*
+ * Hook called with the value of a SYM_FUNC that is replaced or removed,
+ * since the table does not know how to let go of it
+ */
+typedef void (* symtab_dispose_t)(void *value);
+
+void
+symtab_dispose(symtab_dispose_t fn);
+
+typedef void (* symtab_visit_t)(symbol_t *symbol, void *arg);
+
+void
+symtab_walk(symtab_t *symtab, symtab_visit_t fn, void *arg);
+
+symtab_t *
+symtab_set(symtab_t *symtab, char *name, stype_t type, void *value);
+
+symtab_t *
+symtab_set_int(symtab_t *symtab, char *name, int64_t number);
+
+symtab_t *
+symtab_set_array(symtab_t *symtab, char *name, int count, char **items);
+
+symtab_t *
+symtab_append(symtab_t *symtab, char *name, int count, char **items);
+
+const char *
+symtab_string(symbol_t *symbol);
+
+symtab_t *
+symtab_export(symtab_t *symtab, char *name, int exported);
+
+unsigned
+symtab_generation(symtab_t *symtab);
+
+symtab_t *
+symtab_remove(symtab_t *symtab, char *name);
 
 symbol_t *
-symtab_lookup(symbol_t *symtab, char *name);
+symtab_lookup(symtab_t *symtab, char *name);
 
 void *
-symtab_fetch(symbol_t *symtab, char *name, void *value);
+symtab_fetch(symtab_t *symtab, char *name, void *value);
 
 int
-symtab_size(symbol_t *symtab);
+symtab_size(symtab_t *symtab);
 
 void
-symtab_free(symbol_t *symtab);
+symtab_free(symtab_t *symtab);
  
 void
-symtab_print(symbol_t *symtab);
+symtab_print(symtab_t *symtab);
  
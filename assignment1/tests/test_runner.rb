@@ -79,6 +79,10 @@ TIMEOUT=2
   {tc: 'Check if relative path commands will run', depends: :EXTERNAL, cmd: relative_path_to(path_for('uname')), expected: %x{uname}.chomp, explanation: "Relative path command not executed ", marks: 0 },
   {tc: 'Check if environment variables are implemented', depends: :USERVARS, cmd: 'PS1="% "', expected: '% ', explanation: "Failed to set a new command prompt into PS1", marks: 0 },
   {tc: 'Print environment variables with an internal command', depends: :EXTERNAL, cmd: 'env', expected: 'PS1=', explanation: "Expected to be able view environment variables with the 'env' command", marks: 3 },
+  {tc: 'Pass a setting in front of a command into its environment', depends: :ENV, cmd: 'LSHTMP=pre"sent" env', expected: 'LSHTMP=present', explanation: "A setting in front of a command was not in its environment", marks: 0 },
+  {tc: 'Check that a setting in front of a command is for that command alone', depends: :ENV, cmd: ['LSHTMP=x env > /dev/null', 'echo "<$LSHTMP>"'], expected: '<>', explanation: "A setting in front of a command was still set after it", marks: 0 },
+  {tc: 'Check that printf skips a -- before its format', depends: :BUILTINS, cmd: 'printf -- "%s-%s\\n" dash done', expected: 'dash-done', explanation: "printf took -- as its format", marks: 0 },
+  {tc: 'Check that printf %b takes octal escapes without a leading 0', depends: :BUILTINS, cmd: 'printf "%b\\n" "a\\101b"', expected: 'aAb', explanation: "printf %b did not expand \\NNN", marks: 0 },
   {tc: 'Check if command backgrounding is implemented', depends: :EXTERNAL, cmd: 'tests/sleep.sh &' , expected: @prompt, explanation: "Command backgrounding not implemented or not working", marks: 3 },
   {tc: 'Check if output redirection is implemented', depends: :EXTERNAL, cmd: 'echo redirection > outfile.txt', expected: 'Runnable.redirectto', explanation: "Output redirection not implemented or not working", marks: 3 },
   {tc: 'Check if input redirection is implemented', depends: :EXTERNAL, cmd: 'cat < outfile.txt', expected: 'redirection', explanation: "Input redirection not implemented or not working", marks: 3 },
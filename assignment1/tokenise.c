@@ -4,6 +4,10 @@
  * Tokenise a string into a list of typed tokens suitable for subsequent
  * use as an argv[] vector. There is virtually no input error handling.
  *
+ * Tokens are separated by white space or the special characters below.
+ * Within a token, 'single quotes' and "double quotes" group white space
+ * and special characters and a backslash escapes the next character.
+ *
  * Copyright (C) 2012  Brian Gillespie
  *
  * This program is free software: you can redistribute it and/or modify
@@ -25,15 +29,19 @@
 #include <ctype.h>
 #include <string.h>
 #include <assert.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
 
+#include "arena.h"
 #include "tokenise.h"
 
 typedef enum {
   S_START,
   S_DQUOTE,
   S_SQUOTE,
-  S_TOKEN,
-  S_SPECIAL
+  S_TOKEN
 } state_t;
 
 #ifdef LSH_ENABLE_USERVARS
@@ -44,116 +52,479 @@ typedef enum {
 
 #define SPECIAL(c)        ((c) != '\\' && SPECIAL_CHARS(c))
 
-#define TERMINAL(c, ep)   (((c) == '\0' || isspace(c) || SPECIAL(c)) && (ep) == NULL)
+#ifdef LSH_ENABLE_USERVARS
+#define SPECIAL_STOPS     "|&<>="
+#define EXPANDS(c)        ((c) == '$')
+#define EXPAND_STOPS      "$"
+#else
+#define SPECIAL_STOPS     "|&<>"
+#define EXPANDS(c)        0
+#define EXPAND_STOPS      ""
+#endif
+
+#define TERMINAL(c)       ((c) == '\0' || isspace(c) || SPECIAL(c))
+
+#define QUOTING(c)        ((c) == '\\' || (c) == '\'' || (c) == '"')
+
+// Characters a backslash escapes inside double quotes
+#define DQ_ESCAPE(c)      ((c) == '"' || (c) == '\\' || (c) == '$' || (c) == '`')
+
+static ttype_t
+special(int c)
+{
+  switch (c) {
+  case '|': return T_PIPE;
+  case '&': return T_BACKGROUND;
+  case '<': return T_FROMFILE;
+  case '>': return T_TOFILE;
+#ifdef LSH_ENABLE_USERVARS
+  case '=': return T_ASSIGN;
+#endif
+  case ';': return T_ENDSTMT;
+  default:  return T_UNDEF;   // Error
+  }
+}
 
 /*
- * Return a dynamically allocated array of tokens and update the count
- * with the number of fetched tokens if provided by the caller
+ * Most of the time is spent skipping over runs of bytes that need no
+ * attention: white space between tokens, ordinary characters within a
+ * token and anything inside quotes. Each scanner returns the first byte
+ * at or after p (and before end) that ends such a run, or end.
+ *
+ * The scalar scanners are the reference. The SSE2 and AVX2 ones look at
+ * 16 or 32 bytes at a time and must stop at exactly the same place,
+ * which TOKENISE_TEST checks. The best available is picked at run time
  */
-token_t **
-tokenise_fetch(const char *src, int *count)
+typedef const char *(* scan_t)(const char *p, const char *end);
+
+typedef struct {
+  const char *name;
+  scan_t space;             // First byte that is not white space
+  scan_t word;              // First TERMINAL, QUOTING or EXPANDS byte
+  scan_t squote;            // Next ' or '\0'
+  scan_t dquote;            // Next ", \\, EXPANDS or '\0'
+} scanner_t;
+
+static const char *
+space_scalar(const char *p, const char *end)
 {
-  token_t **tokens = NULL;
-  int tmp_count;
-  if (!count) {
-    count = &tmp_count;
+  while (p < end && isspace((unsigned char)*p)) {
+    p++;
+  }
+  return p;
+}
+
+static const char *
+word_scalar(const char *p, const char *end)
+{
+  while (p < end && !TERMINAL((unsigned char)*p) && !QUOTING(*p) && !EXPANDS(*p)) {
+    p++;
+  }
+  return p;
+}
+
+static const char *
+squote_scalar(const char *p, const char *end)
+{
+  while (p < end && *p && *p != '\'') {
+    p++;
+  }
+  return p;
+}
+
+static const char *
+dquote_scalar(const char *p, const char *end)
+{
+  while (p < end && *p && *p != '"' && *p != '\\' && !EXPANDS(*p)) {
+    p++;
+  }
+  return p;
+}
+
+static const scanner_t scalar = {
+  "scalar", space_scalar, word_scalar, squote_scalar, dquote_scalar
+};
+
+#ifdef HAVE_X86_SIMD
+/*
+ * Build a mask of the bytes of x that are '\0' (if nul), white space
+ * (if space) or any of the stops. The stops are string constants so
+ * once inlined the loop over them disappears
+ */
+#define MATCH(W, x, stops, nul, space) ({                                    \
+  __m##W##i m_ = SET0_##W();                                                \
+  const char *s_;                                                           \
+  if (nul) {                                                                \
+    m_ = CMPEQ_##W(x, SET0_##W());                                          \
+  }                                                                         \
+  if (space) {                                                              \
+    /* '\t' to '\r' is a range so needs one compare, not five */            \
+    __m##W##i t_ = SUB_##W(x, SET1_##W('\t'));                              \
+    m_ = OR_##W(m_, CMPEQ_##W(MIN_##W(t_, SET1_##W('\r' - '\t')), t_));     \
+    m_ = OR_##W(m_, CMPEQ_##W(x, SET1_##W(' ')));                           \
+  }                                                                         \
+  for (s_ = (stops); *s_; s_++) {                                           \
+    m_ = OR_##W(m_, CMPEQ_##W(x, SET1_##W(*s_)));                           \
+  }                                                                         \
+  (unsigned)MOVEMASK_##W(m_);                                               \
+})
+
+#define SET0_128()        _mm_setzero_si128()
+#define SET1_128(c)       _mm_set1_epi8(c)
+#define CMPEQ_128(a, b)   _mm_cmpeq_epi8(a, b)
+#define SUB_128(a, b)     _mm_sub_epi8(a, b)
+#define MIN_128(a, b)     _mm_min_epu8(a, b)
+#define OR_128(a, b)      _mm_or_si128(a, b)
+#define MOVEMASK_128(m)   _mm_movemask_epi8(m)
+#define LOAD_128(p)       _mm_loadu_si128((const __m128i *)(p))
+
+#define SET0_256()        _mm256_setzero_si256()
+#define SET1_256(c)       _mm256_set1_epi8(c)
+#define CMPEQ_256(a, b)   _mm256_cmpeq_epi8(a, b)
+#define SUB_256(a, b)     _mm256_sub_epi8(a, b)
+#define MIN_256(a, b)     _mm256_min_epu8(a, b)
+#define OR_256(a, b)      _mm256_or_si256(a, b)
+#define MOVEMASK_256(m)   _mm256_movemask_epi8(m)
+#define LOAD_256(p)       _mm256_loadu_si256((const __m256i *)(p))
+
+/*
+ * Define a scanner that compares W / 8 bytes at a time, finishing off
+ * the last few with its scalar twin. With invert it stops at the first
+ * byte that does not match rather than the first that does
+ */
+#define SCANNER(name, isa, W, stops, nul, space, invert)                    \
+__attribute__((target(#isa), optimize("O2")))                               \
+static const char *                                                         \
+name##_##isa(const char *p, const char *end)                                \
+{                                                                           \
+  const unsigned all = W == 256 ? 0xffffffffu : 0xffffu;                    \
+  while (end - p >= W / 8) {                                                \
+    __m##W##i x = LOAD_##W(p);                                              \
+    unsigned mask = MATCH(W, x, stops, nul, space);                         \
+    if (invert) {                                                           \
+      mask = ~mask & all;                                                   \
+    }                                                                       \
+    if (mask) {                                                             \
+      return p + __builtin_ctz(mask);                                       \
+    }                                                                       \
+    p += W / 8;                                                             \
+  }                                                                         \
+  return name##_scalar(p, end);                                             \
+}
+
+SCANNER(space,  sse2, 128, "", 0, 1, 1)
+SCANNER(word,   sse2, 128, SPECIAL_STOPS EXPAND_STOPS "\\'\"", 1, 1, 0)
+SCANNER(squote, sse2, 128, "'", 1, 0, 0)
+SCANNER(dquote, sse2, 128, EXPAND_STOPS "\"\\", 1, 0, 0)
+
+SCANNER(space,  avx2, 256, "", 0, 1, 1)
+SCANNER(word,   avx2, 256, SPECIAL_STOPS EXPAND_STOPS "\\'\"", 1, 1, 0)
+SCANNER(squote, avx2, 256, "'", 1, 0, 0)
+SCANNER(dquote, avx2, 256, EXPAND_STOPS "\"\\", 1, 0, 0)
+
+static const scanner_t sse2 = {
+  "sse2", space_sse2, word_sse2, squote_sse2, dquote_sse2
+};
+
+static const scanner_t avx2 = {
+  "avx2", space_avx2, word_avx2, squote_avx2, dquote_avx2
+};
+#endif /* HAVE_X86_SIMD */
+
+static const scanner_t *scanner;
+
+/*
+ * Select a scanner by name, or the best this CPU supports when name is
+ * NULL. Returns the name of the scanner in use, or NULL if the one asked
+ * for is not available here
+ */
+const char *
+tokenise_scanner(const char *name)
+{
+  const scanner_t *candidates[3];
+  int i, n = 0;
+
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    candidates[n++] = &avx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    candidates[n++] = &sse2;
+  }
+#endif
+  candidates[n++] = &scalar;
+
+  for (i = 0; i < n; i++) {
+    if (!name || strcmp(name, candidates[i]->name) == 0) {
+      scanner = candidates[i];
+      return scanner->name;
+    }
+  }
+  return NULL;
+}
+
+#ifdef LSH_ENABLE_USERVARS
+/*
+ * The end of the $(( ... )) starting at p: just past the "))" that
+ * closes it, or end if nothing does. Nothing inside it splits the
+ * token, so 1 + 2 or a < b need no quotes
+ */
+static char *
+arith_end(char *p, char *end)
+{
+  int depth = 0;
+
+  for (; p < end && *p; p++) {
+    if (*p == '(') {
+      depth++;
+    } else if (*p == ')' && --depth == 1 && p + 1 < end && p[1] == ')') {
+      return p + 2;
+    }
   }
-  *count = 0;
-  char *cp = (char *)src, *sp = NULL, *ep = NULL, *value = NULL;
+  return p;
+}
+#endif
+
+/*
+ * Split the first len bytes of src (or up to a '\0' if sooner) into
+ * views of its tokens. Quotes and backslash escapes are removed in
+ * place, so a view may be shorter than the text it was made from but
+ * no byte is ever copied anywhere else. Views are not '\0' terminated:
+ * the text following one is either white space, which the caller can
+ * overwrite, or a special character whose type has been recorded.
+ *
+ * An unquoted or double quoted '$' is replaced by CTL_EXPAND and the
+ * view flagged V_EXPAND, so that the expansion can tell it from a '$'
+ * that was quoted or escaped once the quotes are gone. Parentheses are
+ * ordinary characters, but V_OPEN and V_CLOSE record those that were
+ * not quoted at either end of a token, and V_QUOTED whether anything
+ * was, for name=( ... )
+ *
+ * Returns an array, allocated from the arena, of count views
+ */
+tview_t *
+tokenise_views(arena_t *arena, char *src, size_t len, int *count)
+{
+  tview_t *views = NULL;
+  int capacity = 0, n = 0;
+  char *cp = src, *end = src + len;
+  char *sp = NULL;          // Start of the current token
+  char *wp = NULL;          // Where its next unquoted byte goes
+  char *rp;                 // End of a run of bytes taken in one go
+  int flags = 0;
+  int expand = 0;           // The current token has something to expand
+  int paren = 0;            // Its V_OPEN, V_CLOSE and V_QUOTED
+  char *plain = NULL;       // The end of its last unquoted run
   state_t state = S_START;
-  ttype_t type = T_UNDEF;
 
-  while (*cp || state != S_START) {
+  if (!scanner) {
+    (void)tokenise_scanner(NULL);
+  }
+
+  /*
+   * Move the run of bytes up to rp to the end of the token. Until
+   * something has been removed from it they are already in place
+   */
+#define TAKE(rp)  do {                   \
+    if (wp != cp) {                      \
+      memmove(wp, cp, (rp) - cp);        \
+    }                                    \
+    wp += (rp) - cp;                     \
+    cp = (rp);                           \
+  } while (0)
+
+  /*
+   * Mark the '$' at cp, taking the whole of any $(( ... )) with it
+   */
+#define EXPAND()  do {                                          \
+    *wp++ = CTL_EXPAND;                                         \
+    cp++;                                                       \
+    expand = V_EXPAND;                                          \
+    if (cp + 1 < end && cp[0] == '(' && cp[1] == '(') {         \
+      rp = arith_end(cp, end);                                  \
+      TAKE(rp);                                                 \
+    }                                                           \
+  } while (0)
+
+  for (;;) {
+    int c = cp < end ? (unsigned char)*cp : '\0';
+    ttype_t type = T_UNDEF;
+
     switch (state) {
     case S_START:
-      if (isspace(*cp)) {
+      if (c == '\0') {
+        *count = n;
+        return views;
+      } else if (isspace(c)) {
         // Skip over white space
-        cp++;
-      } else if (*cp == '\\' && ep == NULL) {
-        // Escaping next character
-        ep = cp++;
-      } else if (*cp == '"' && ep == NULL) {
-        // Start of a dquote string. Mark the first character
-        sp = ++cp;
-        state = S_DQUOTE;
-      } else if (*cp == '\'' && ep == NULL) {
-        // Start of a squote string. Mark the first character
-        sp = ++cp;
-        state = S_SQUOTE;
-      } else if (SPECIAL(*cp)) {
-        // Ordinary token
+        cp = (char *)scanner->space(cp + 1, end);
+        flags = 0;
+      } else if (SPECIAL(c)) {
+        // A single character token
         sp = cp++;
-        state = S_SPECIAL;
+        wp = cp;
+        type = special(c);
       } else {
         // Ordinary token
-        sp = cp++;
+        sp = wp = cp;
+        paren = c == '(' ? V_OPEN : 0;
+        plain = NULL;
         state = S_TOKEN;
       }
       break;
-    case S_DQUOTE:
-      // End of a dquote string.
-      if ((*cp == '"' && ep == NULL) || *cp == '\0') {
-        value = strndup(sp, cp - sp);
+    case S_TOKEN:
+      if (TERMINAL(c)) {
         type = T_ARG;
         state = S_START;
+        if (plain == wp && wp[-1] == ')') {
+          paren |= V_CLOSE;
+        }
+      } else if (c == '\\') {
+        // Escaping next character, if there is one
+        paren |= V_QUOTED;
+        if (++cp < end && *cp) {
+          *wp++ = *cp++;
+        }
+      } else if (c == '\'') {
+        // Start of a squote string within the token
+        cp++;
+        paren |= V_QUOTED;
+        state = S_SQUOTE;
+      } else if (c == '"') {
+        // Start of a dquote string within the token
+        cp++;
+        paren |= V_QUOTED;
+        state = S_DQUOTE;
+      } else if (EXPANDS(c)) {
+        EXPAND();
+      } else {
+        // Take the whole run of ordinary characters in one go
+        rp = (char *)scanner->word(cp + 1, end);
+        TAKE(rp);
+        plain = wp;
       }
-      if (*cp) { cp++; }
       break;
     case S_SQUOTE:
-      // End of a squote string.
-      if ((*cp == '\'' && ep == NULL) || *cp == '\0') {
-        value = strndup(sp, cp - sp);
-        type = T_ARG;
-        state = S_START;
+      // End of a squote string. Nothing is special until then
+      if (c == '\0' || c == '\'') {
+        if (c) { cp++; }
+        state = S_TOKEN;
+      } else {
+        rp = (char *)scanner->squote(cp + 1, end);
+        TAKE(rp);
       }
-      if (*cp) { cp++; }
       break;
-    case S_TOKEN:
-      if (TERMINAL(*cp, ep)) {
-        // End non-spcecial token processing
-        value = strndup(sp, cp - sp);
-        type = T_ARG;
-        if (SPECIAL(*cp)) {
-          // Push it back to be handled in the START state
-          if (cp != src) {
-            cp--;
-          }
+    case S_DQUOTE:
+      // End of a dquote string.
+      if (c == '\0' || c == '"') {
+        if (c) { cp++; }
+        state = S_TOKEN;
+      } else if (c == '\\') {
+        if (cp + 1 < end && DQ_ESCAPE(cp[1])) {
+          cp++;
         }
-        state = S_START;
-      }
-      if (*cp) { cp++; }
-      break;
-    case S_SPECIAL:
-      value = strndup(sp, 1);
-      switch (*sp) {
-      case '|': type = T_PIPE; break;
-      case '&': type = T_BACKGROUND; break;
-      case '<': type = T_FROMFILE; break;
-      case '>': type = T_TOFILE; break;
-#ifdef LSH_ENABLE_USERVARS
-      case '=': type = T_ASSIGN; break;
-#endif
-      case ';': type = T_ENDSTMT; break;
-      default:  type = T_UNDEF; break;  // Error
+        *wp++ = *cp++;
+      } else if (EXPANDS(c)) {
+        EXPAND();
+      } else {
+        rp = (char *)scanner->dquote(cp + 1, end);
+        TAKE(rp);
       }
-      state = S_START;
       break;
     }
-    if (value) {
+
+    if (type != T_UNDEF) {
       assert(state == S_START);
-      assert(type != T_UNDEF);
-      int n = *count;
-      tokens = (token_t **)realloc(tokens, ++*count * sizeof(token_t *));
-      tokens[n] = malloc(sizeof(token_t));
-      tokens[n]->value = value;
-      tokens[n]->type = type;
-      value = NULL;
-      type = T_UNDEF;
+      if (n == capacity) {
+        /*
+         * Nothing else is allocated from the arena while we run so
+         * the array is almost always extended where it is
+         */
+        int size = capacity ? capacity * 2 : 16;
+        views = arena_realloc(arena, views, capacity * sizeof(tview_t),
+                              size * sizeof(tview_t));
+        capacity = size;
+      }
+      views[n].offset = sp - src;
+      views[n].length = wp - sp;
+      views[n].type = type;
+      views[n].flags = flags | expand | paren;
+      n++;
+      // Anything up to the next white space is joined to this token
+      flags = V_JOINED;
+      expand = 0;
+      paren = 0;
     }
   }
+#undef TAKE
+#undef EXPAND
+}
+
+/*
+ * Tokens come either from the heap or, when one is given, an arena
+ */
+static void *
+alloc(arena_t *arena, size_t size)
+{
+  return arena ? arena_alloc(arena, size) : malloc(size);
+}
+
+static char *
+copy(arena_t *arena, const char *s, size_t n)
+{
+  return arena ? arena_strndup(arena, s, n) : strndup(s, n);
+}
+
+/*
+ * Make views of a scratch copy of src then turn each into a token
+ */
+static token_t **
+fetch(arena_t *arena, const char *src, int *count)
+{
+  arena_t scratch = { 0 };
+  arena_t *views_arena = arena ? arena : &scratch;
+  token_t **tokens = NULL;
+  int tmp_count, i;
+  if (!count) {
+    count = &tmp_count;
+  }
+  size_t len = strlen(src);
+  char *text = arena_strndup(views_arena, src, len);
+  tview_t *views = tokenise_views(views_arena, text, len, count);
+
+  if (*count > 0) {
+    tokens = alloc(arena, *count * sizeof(token_t *));
+  }
+  for (i = 0; i < *count; i++) {
+    tokens[i] = alloc(arena, sizeof(token_t));
+    tokens[i]->value = copy(arena, &text[views[i].offset], views[i].length);
+    tokens[i]->type = views[i].type;
+  }
+  arena_free(&scratch);
   return tokens;
 }
 
+/*
+ * Return a dynamically allocated array of tokens and update the count
+ * with the number of fetched tokens if provided by the caller
+ */
+token_t **
+tokenise_fetch(const char *src, int *count)
+{
+  return fetch(NULL, src, count);
+}
+
+/*
+ * As tokenise_fetch() but everything is allocated from the arena and
+ * so is released by the next arena_reset() rather than tokenise_free()
+ */
+token_t **
+tokenise_arena(arena_t *arena, const char *src, int *count)
+{
+  return fetch(arena, src, count);
+}
+
 void
 tokenise_free(token_t *tokens[], int count)
 {
@@ -185,12 +556,149 @@ tokenise_print(token_t *tokens[], int count)
 
 #ifdef TOKENISE_TEST
 
+#include <stdarg.h>
+#include <time.h>
+
+static const char *scanners[] = { "scalar", "sse2", "avx2" };
+#define NSCANNERS (sizeof(scanners) / sizeof(scanners[0]))
+
+static void fail(const char *fmt, ...)
+{
+  va_list argp;
+  va_start(argp, fmt);
+  vfprintf(stderr, fmt, argp);
+  va_end(argp);
+  exit(1);
+}
+
+/*
+ * Tokenise the same text with every scanner this CPU has and insist that
+ * they produce identical views and identical in-place edits
+ */
+static void differential(int rounds)
+{
+  static const char alphabet[] = "ab_-/. \t\n\v\f\r|&<>=\\'\"$()";
+  const size_t max = 4096;
+  char *text = malloc(max + 64);
+  char *expected = malloc(max + 64), *buf = malloc(max + 64);
+  arena_t arena = { 0 };
+  int round, tested = 0;
+
+  srand(2012);
+  for (round = 0; round < rounds; round++) {
+    size_t len = rand() % (round % 10 == 0 ? max : 96), i;
+    size_t align = rand() % 32;
+    for (i = 0; i < len; i++) {
+      int r = rand() % 100;
+      if (r < 70) {
+        // Mostly long runs of one kind of byte
+        text[i] = (i && r < 55) ? text[i - 1] : alphabet[rand() % (sizeof(alphabet) - 1)];
+      } else if (r < 99) {
+        text[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+      } else {
+        text[i] = r % 2 ? (char)(0x80 + rand() % 128) : '\0';
+      }
+    }
+
+    int j, n0 = 0;
+    tview_t *v0 = NULL;
+    for (j = 0; j < NSCANNERS; j++) {
+      if (!tokenise_scanner(scanners[j])) {
+        continue;
+      }
+      char *b = (j == 0 ? expected : buf) + align;
+      memcpy(b, text, len);
+      int n;
+      tview_t *v = tokenise_views(&arena, b, len, &n);
+      if (j == 0) {
+        n0 = n;
+        v0 = v;
+        continue;
+      }
+      if (n != n0) {
+        fail("round %d: %s found %d tokens, scalar %d\n", round, scanners[j], n, n0);
+      }
+      if (memcmp(v, v0, n * sizeof(tview_t)) != 0) {
+        fail("round %d: %s views differ from scalar\n", round, scanners[j]);
+      }
+      if (memcmp(b, expected + align, len) != 0) {
+        fail("round %d: %s in-place edits differ from scalar\n", round, scanners[j]);
+      }
+      tested++;
+    }
+    arena_reset(&arena);
+  }
+  arena_free(&arena);
+  free(text);
+  free(expected);
+  free(buf);
+  printf("differential: %d rounds, %d comparisons against scalar\n", rounds, tested);
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Throughput of each scanner on argument lists close to ARG_MAX
+ */
+static void bench(void)
+{
+  const char *formats[] = {
+    " arg%06d", " /usr/src/linux/drivers/gpu/drm/amd/display/dc/dml/%06d.o",
+    " 'quoted %d'", " \"dq\\\"%d\"", " a\\ %d"
+  };
+  const char *names[] = { "plain", "paths", "squoted", "dquoted", "escaped" };
+  const size_t size = 2 * 1024 * 1024 - 64;
+  char *line = malloc(size + 64), *work = malloc(size + 64);
+  arena_t arena = { 0 };
+  int f, j;
+
+  for (f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+    size_t len = 0;
+    int i = 0;
+    while (len < size - 32) {
+      len += sprintf(&line[len], formats[f], i++);
+    }
+    for (j = 0; j < NSCANNERS; j++) {
+      if (!tokenise_scanner(scanners[j])) {
+        continue;
+      }
+      double best = 1e9;
+      int k, n;
+      for (k = 0; k < 10; k++) {
+        memcpy(work, line, len);
+        double start = now();
+        (void)tokenise_views(&arena, work, len, &n);
+        double elapsed = now() - start;
+        if (elapsed < best) {
+          best = elapsed;
+        }
+        arena_reset(&arena);
+      }
+      printf("%-8s %-7s %8d tokens %8.1f MB/s\n", names[f], scanners[j], n,
+             len / best / 1e6);
+    }
+  }
+  arena_free(&arena);
+}
+
 int main(int argc, char *argv[])
 {
+  if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+    bench();
+    exit(0);
+  }
+
   int count;
   token_t **tokens = tokenise_fetch("export VAR='123'; ps -ef|egrep '(root | arch)'|sort -u&", &count);
   tokenise_print(tokens, count);
   tokenise_free(tokens, count);
+
+  differential(20000);
   exit(0);
 }
 #endif
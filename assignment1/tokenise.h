@@ -21,6 +21,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "arena.h"
+
 typedef enum {
   T_UNDEF,
   T_ARG,
@@ -37,9 +39,43 @@ typedef struct {
   ttype_t type;
 } token_t;
 
+// No white space separates the token from the one before
+#define V_JOINED  0x01
+// The token has a CTL_EXPAND in it
+#define V_EXPAND  0x02
+// The token starts with an unquoted '(' or ends with an unquoted ')'
+#define V_OPEN    0x04
+#define V_CLOSE   0x08
+// Some of the token was quoted or escaped
+#define V_QUOTED  0x10
+
+/*
+ * Stands in for each '$' that is to be expanded
+ */
+#define CTL_EXPAND  '\001'
+
+/*
+ * A token as a slice of the caller's own buffer
+ */
+typedef struct {
+  unsigned offset;
+  unsigned length;
+  ttype_t type;
+  int flags;
+} tview_t;
+
+tview_t *
+tokenise_views(arena_t *arena, char *src, size_t len, int *count);
+
+const char *
+tokenise_scanner(const char *name);
+
 token_t **
 tokenise_fetch(const char *src, int *count);
 
+token_t **
+tokenise_arena(arena_t *arena, const char *src, int *count);
+
 void
 tokenise_free(token_t *tokens[], int count);
 
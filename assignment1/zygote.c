@@ -0,0 +1,402 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * A spawn server, forked while the shell is still small, that starts
+ * commands on the shell's behalf
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE             // For O_PATH, close_range() and MSG_CMSG_CLOEXEC
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "zygote.h"
+
+#ifdef LSH_ENABLE_ZYGOTE
+
+/*
+ * fork() has to copy the page tables of the whole shell, so the more
+ * the shell holds the longer every command takes to start. The server
+ * is forked once, before any of that has been allocated, and does the
+ * forking from then on in its own small address space.
+ *
+ * Each request is a header, then the path, argv and envp strings laid
+ * end to end, with the descriptors the command is to have as its
+ * standard input, output and error and one for our working directory
+ * passed alongside. The server clones the command with CLONE_PARENT,
+ * so that it is the shell's child and not the server's, and is waited
+ * for, stopped and put in the foreground just like any other. The
+ * reply is its pid and, if the execve() failed, why
+ */
+typedef struct {
+  size_t len;                   // Of the strings that follow
+  int argc;
+  int envc;
+  pid_t pgid;                   // To join, or 0 to lead a new one
+} request_t;
+
+typedef struct {
+  pid_t pid;
+  int error;
+} reply_t;
+
+// Standard input, output and error and the working directory
+#define NFDS 4
+
+static int sock = -1;           // Our end, -1 if there is no server
+static pid_t shell;             // The only process to start one or ask it
+static pid_t server;
+static int held;                // Commands are to be started by the shell
+
+/*
+ * Read exactly len bytes or fail
+ */
+static int
+full_read(int fd, void *buf, size_t len)
+{
+  char *p = buf;
+
+  while (len > 0) {
+    ssize_t n = read(fd, p, len);
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/*
+ * Receive a request header and the descriptors that came with it
+ */
+static int
+receive(request_t *request, int fds[NFDS])
+{
+  char control[CMSG_SPACE(NFDS * sizeof(int))];
+  struct iovec iov = { request, sizeof(*request) };
+  struct msghdr msg = { 0 };
+  struct cmsghdr *cmsg;
+  ssize_t n;
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  do {
+    n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0 || full_read(sock, (char *)request + n, sizeof(*request) - n) < 0) {
+    return -1;
+  }
+  cmsg = CMSG_FIRSTHDR(&msg);
+  if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(NFDS * sizeof(int))) {
+    return -1;
+  }
+  memcpy(fds, CMSG_DATA(cmsg), NFDS * sizeof(int));
+  return 0;
+}
+
+/*
+ * Start one command for the shell. We wait for it to get as far as
+ * its execve(), which closes the pipe, or to tell us down it why that
+ * failed, so errors are reported just as posix_spawn() would
+ */
+static reply_t
+start(request_t *request, int fds[NFDS], char *path, char **argv, char **envp)
+{
+  reply_t reply = { -1, 0 };
+  int p[2], i;
+
+  if (pipe2(p, O_CLOEXEC) < 0) {
+    reply.error = errno;
+    return reply;
+  }
+  reply.pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, 0, 0, 0);
+  if (reply.pid == 0) {
+    // Only plain system calls from here, glibc does not know we exist
+    setpgid(0, request->pgid);
+    for (i = 0; i < 3; i++) {
+      dup2(fds[i], i);
+    }
+    if (fchdir(fds[3]) == 0) {
+      execve(path, argv, envp);
+    }
+    i = errno;
+    if (write(p[1], &i, sizeof(i)) < 0) {
+      // Nothing more we can do
+    }
+    _exit(127);
+  }
+  close(p[1]);
+  if (reply.pid < 0) {
+    reply.error = errno;
+  } else if (full_read(p[0], &reply.error, sizeof(reply.error)) < 0) {
+    reply.error = 0;
+  }
+  close(p[0]);
+  return reply;
+}
+
+/*
+ * The server itself, which lives until the shell goes away
+ */
+static void
+serve(void)
+{
+  char *text = NULL, **vector = NULL;
+  size_t room = 0;
+  int slots = 0;
+
+  for (;;) {
+    request_t request;
+    int fds[NFDS], i, n;
+    reply_t reply;
+    char *s;
+
+    if (receive(&request, fds) < 0) {
+      _exit(0);
+    }
+    if (request.len > room) {
+      room = request.len;
+      text = realloc(text, room);
+    }
+    if (request.argc + request.envc + 2 > slots) {
+      slots = request.argc + request.envc + 2;
+      vector = realloc(vector, slots * sizeof(char *));
+    }
+    if (full_read(sock, text, request.len) < 0) {
+      _exit(0);
+    }
+
+    // The path, then argv and envp, each with their NULL
+    s = text + strlen(text) + 1;
+    for (i = 0, n = request.argc + request.envc; i < n; i++) {
+      vector[i + (i >= request.argc)] = s;
+      s += strlen(s) + 1;
+    }
+    vector[request.argc] = NULL;
+    vector[n + 1] = NULL;
+
+    reply = start(&request, fds, text, vector, &vector[request.argc + 1]);
+    for (i = 0; i < NFDS; i++) {
+      close(fds[i]);
+    }
+    if (write(sock, &reply, sizeof(reply)) != sizeof(reply)) {
+      _exit(0);
+    }
+  }
+}
+
+/*
+ * Fork the server. It leads a process group of its own so that nothing
+ * typed at the terminal reaches it, and puts back anything about
+ * signals that the shell has changed so the commands it starts begin
+ * with the defaults
+ */
+static void
+zygote_start(void)
+{
+  int sv[2];
+  sigset_t none;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+    return;
+  }
+  fflush(stdout);
+  server = fork();
+  if (server < 0) {
+    close(sv[0]);
+    close(sv[1]);
+    return;
+  }
+  if (server == 0) {
+    int null = open("/dev/null", O_RDWR);
+    dup2(null, STDIN_FILENO);
+    dup2(null, STDOUT_FILENO);
+    dup2(null, STDERR_FILENO);
+    dup2(sv[1], 3);
+    close_range(4, ~0U, 0);
+    sock = 3;
+    fcntl(sock, F_SETFD, FD_CLOEXEC);
+    setpgid(0, 0);
+    signal(SIGTTOU, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+    serve();
+  }
+  close(sv[1]);
+  sock = sv[0];
+}
+
+/*
+ * Called by the shell as it starts, while it is still small, with
+ * start set if the server will be wanted. It is never started later,
+ * when forking it would cost what it is there to save
+ */
+void
+zygote_init(int start)
+{
+  shell = getpid();
+  if (start) {
+    zygote_start();
+  }
+}
+
+/*
+ * While held, commands are started by the shell itself, so that they
+ * are its descendants and not the server's, as perfstat needs
+ */
+void
+zygote_hold(int hold)
+{
+  held = hold;
+}
+
+/*
+ * Send one request and wait for the reply
+ */
+static int
+request(request_t *header, char *text, int fds[NFDS], reply_t *reply)
+{
+  char control[CMSG_SPACE(NFDS * sizeof(int))];
+  struct iovec iov[2] = { { header, sizeof(*header) }, { text, header->len } };
+  struct msghdr msg = { 0 };
+  struct cmsghdr *cmsg;
+  size_t total = sizeof(*header) + header->len;
+  ssize_t n;
+
+  memset(control, 0, sizeof(control));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(NFDS * sizeof(int));
+  memcpy(CMSG_DATA(cmsg), fds, NFDS * sizeof(int));
+
+  do {
+    n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) {
+    return -1;
+  }
+  // Whatever did not fit goes after it, without the descriptors
+  while ((size_t)n < total) {
+    ssize_t sent;
+    size_t done = n;
+    if (done < sizeof(*header)) {
+      sent = send(sock, (char *)header + done, sizeof(*header) - done, MSG_NOSIGNAL);
+    } else {
+      sent = send(sock, text + done - sizeof(*header), total - done, MSG_NOSIGNAL);
+    }
+    if (sent < 0 && errno != EINTR) {
+      return -1;
+    }
+    n += sent > 0 ? sent : 0;
+  }
+  return full_read(sock, reply, sizeof(*reply));
+}
+
+/*
+ * Have the server start the binary at path, as execute_spawn() would.
+ * Returns -1 with errno ENOSYS if there is no server to ask, when the
+ * caller must start it some other way
+ */
+pid_t
+zygote_spawn(const char *path, char **argv, char **envp, int fds[3], pid_t pgid)
+{
+  static char *text;
+  static size_t room;
+  request_t header = { 0, 0, 0, pgid >= 0 ? pgid : getpgrp() };
+  int pass[NFDS], i;
+  size_t len = strlen(path) + 1;
+  char *t;
+  reply_t reply;
+
+  // None was started, or a forked copy of the shell has to spawn for itself
+  if (sock < 0 || held || getpid() != shell) {
+    errno = ENOSYS;
+    return -1;
+  }
+
+  for (header.argc = 0; argv[header.argc]; header.argc++) {
+    len += strlen(argv[header.argc]) + 1;
+  }
+  for (header.envc = 0; envp[header.envc]; header.envc++) {
+    len += strlen(envp[header.envc]) + 1;
+  }
+  if (len > room) {
+    room = len * 2;
+    text = realloc(text, room);
+  }
+  t = stpcpy(text, path) + 1;
+  for (i = 0; i < header.argc; i++) {
+    t = stpcpy(t, argv[i]) + 1;
+  }
+  for (i = 0; i < header.envc; i++) {
+    t = stpcpy(t, envp[i]) + 1;
+  }
+  header.len = len;
+
+  for (i = 0; i < 3; i++) {
+    pass[i] = fds[i] >= 0 ? fds[i] : i;
+  }
+  pass[3] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (pass[3] < 0) {
+    return -1;
+  }
+  if (request(&header, text, pass, &reply) < 0) {
+    // The server has gone away, so nobody will be asked again
+    close(pass[3]);
+    close(sock);
+    sock = -1;
+    waitpid(server, NULL, WNOHANG);
+    errno = ENOSYS;
+    return -1;
+  }
+  close(pass[3]);
+
+  if (reply.error) {
+    // The child has already exited but we must still reap it
+    if (reply.pid > 0) {
+      (void)waitpid(reply.pid, NULL, 0);
+    }
+    errno = reply.error;
+    return -1;
+  }
+  return reply.pid;
+}
+#endif /* LSH_ENABLE_ZYGOTE */
@@ -0,0 +1,31 @@
+// vim: set ts=2 sw=2 expandtab:
+
+/*
+ * Spawn server interface
+ *
+ * Copyright (C) 2012  Brian Gillespie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/types.h>
+
+void
+zygote_init(int start);
+
+void
+zygote_hold(int hold);
+
+pid_t
+zygote_spawn(const char *path, char **argv, char **envp, int fds[3], pid_t pgid);